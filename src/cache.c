@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * cache.c - Store of pre-rendered display filter output.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "cache.h"
+#include "libpinegpg.h"
+#include "pinegpg.h"
+#include "probes.h"
+#include "scan.h"
+#include "utility.h"
+
+/*
+ * The warmer (pine.gpg -M) renders messages as they are delivered, so that
+ * the display filter only has to copy the output when the user opens one.
+ * Each entry holds the display filter's input from the first PGP block on
+ * and the output it gave, and is named after the hash of that input.  The
+ * hash only finds the entry: the input is always compared in full, so a
+ * message made to collide with another can never be shown its output.
+ *
+ * GPG's verdict depends on the keyring, so an entry older than the keyring
+ * or trust database is stale and is removed instead of used.  The output
+ * also depends on the -v and -l options, so those are part of both the
+ * name and the header, and a viewer run with other settings than the
+ * warmer's renders the message itself.
+ */
+
+#define CACHE_DIR    "pine.gpg-cache"
+#define HEADER_LEN   192
+#define SETTINGS_LEN 128
+
+static const char *keyring_files[] = { "pubring.kbx", "pubring.gpg",
+				       "trustdb.gpg", NULL };
+
+/**
+ * Build the path of the cache directory, or of an entry in it.
+ *
+ * @param  name  The entry name, or NULL for the directory.
+ * @return       A newly allocated path, or NULL.
+ */
+static char *cache_path(const char *name)
+{
+	char *dir, *path;
+	size_t len;
+
+	dir = gnupg_path(CACHE_DIR);
+	if (dir == NULL || name == NULL)
+		return dir;
+
+	len = strlen(dir) + strlen(name) + 2;
+	path = malloc(len);
+	if (path != NULL)
+		snprintf(path, len, "%s/%s", dir, name);
+
+	free(dir);
+
+	return path;
+}
+
+/**
+ * Describe the options that change what the display filter outputs.
+ *
+ * @param  config  The program configuration.
+ * @param  buf     Where to put the description.
+ * @param  size    The size of buf.
+ * @return         Nothing.
+ */
+static void cache_settings(const program_config *config, char *buf,
+			   size_t size)
+{
+	snprintf(buf, size, "v%d b%ld m%ld c%ld a%ld f%ld",
+		 config->lib.verbose, config->lib.max_block,
+		 config->lib.max_message, config->lib.max_cpu,
+		 config->lib.max_as, config->lib.max_fsize);
+}
+
+/**
+ * Build the path of the entry for an input.
+ *
+ * @param  settings  The description of the options from cache_settings().
+ * @param  input     The display filter input, from the first PGP block on.
+ * @param  len       The size of the input in bytes.
+ * @return           A newly allocated path, or NULL.
+ */
+static char *entry_path(const char *settings, const char *input, size_t len)
+{
+	char name[32];
+
+	snprintf(name, sizeof (name), "%016lx", block_hash(input, len) ^
+		 block_hash(settings, strlen(settings)));
+
+	return cache_path(name);
+}
+
+/**
+ * Find when the keyring or trust database last changed.
+ *
+ * @return  The latest modification time, or zero if none were found.
+ */
+static time_t keyring_changed(void)
+{
+	int i;
+	char *path;
+	struct stat sbuf;
+	time_t t = 0;
+
+	for (i = 0; keyring_files[i] != NULL; i++) {
+		path = gnupg_path(keyring_files[i]);
+		if (path != NULL && stat(path, &sbuf) == 0 && sbuf.st_mtime > t)
+			t = sbuf.st_mtime;
+		free(path);
+	}
+
+	return t;
+}
+
+/**
+ * Read exactly len bytes from a file.
+ *
+ * @return  Zero, or -1 on error or early end of file.
+ */
+static int read_full(int f, char *buf, size_t len)
+{
+	ssize_t bytes;
+
+	while (len > 0) {
+		bytes = read(f, buf, len);
+		if (bytes == -1 && errno == EINTR)
+			continue;
+		if (bytes <= 0)
+			return -1;
+		buf += bytes;
+		len -= bytes;
+	}
+
+	return 0;
+}
+
+/**
+ * Look up the pre-rendered output for a display filter input, and append
+ * it to an output buffer if there is one.
+ *
+ * @param  config  The program configuration.
+ * @param  input   The display filter input, from the first PGP block on.
+ * @param  len     The size of the input in bytes.
+ * @param  out     The output buffer, or NULL to only look.
+ * @return         One on a hit, or zero on a miss.
+ */
+int cache_copy(const program_config *config, const char *input, size_t len,
+	       outbuf *out)
+{
+	int f, hit = 0;
+	char *path, hdr[HEADER_LEN + 1], want[HEADER_LEN], buf[BUF_SIZE];
+	char settings[SETTINGS_LEN];
+	unsigned long in_len, out_len;
+	size_t n, done;
+	ssize_t bytes;
+	struct stat sbuf;
+
+	/* Most users never run the warmer, so don't hash the input unless
+	 * there is a cache to look in.
+	 */
+	path = cache_path(NULL);
+	if (path == NULL || stat(path, &sbuf) == -1 || !S_ISDIR(sbuf.st_mode))
+		goto out;
+	free(path);
+
+	cache_settings(config, settings, sizeof (settings));
+	path = entry_path(settings, input, len);
+	if (path == NULL)
+		goto out;
+
+	f = open(path, O_RDONLY);
+	if (f == -1)
+		goto out;
+
+	if (fstat(f, &sbuf) == -1 || read_full(f, hdr, HEADER_LEN) == -1)
+		goto out_close;
+
+	hdr[HEADER_LEN] = '\0';
+	if (sscanf(hdr, "pine.gpg-cache 2 %lu %lu", &in_len, &out_len) != 2 ||
+	    in_len != len ||
+	    (unsigned long) sbuf.st_size != HEADER_LEN + in_len + out_len)
+		goto out_close;
+
+	n = snprintf(want, sizeof (want), "pine.gpg-cache 2 %lu %lu %s",
+		     in_len, out_len, settings);
+	if (n >= sizeof (want) || memcmp(hdr, want, n) != 0 || hdr[n] != ' ')
+		goto out_close;
+
+	if (sbuf.st_mtime < keyring_changed()) {
+		unlink(path);
+		goto out_close;
+	}
+
+	for (done = 0; done < len; done += n) {
+		n = (len - done < sizeof (buf)) ? len - done : sizeof (buf);
+		if (read_full(f, buf, n) == -1 ||
+		    memcmp(buf, input + done, n) != 0)
+			goto out_close;
+	}
+
+	hit = 1;
+
+	/* The output may hold decrypted text, so it goes straight into the
+	 * output buffer's locked memory.
+	 */
+	while (out != NULL && out_len > 0) {
+		bytes = out_read(out, f, out_len);
+		if (bytes <= 0)
+			die_x(EXIT_FAILURE, (bytes == -1) ? errno : 0,
+			      out->result_file, "Failed to read %s", path);
+		out_len -= bytes;
+	}
+
+out_close:
+	close(f);
+out:
+	PROBE2(cache__lookup, (long) len, hit);
+	free(path);
+
+	return hit;
+}
+
+/**
+ * Render a display filter input and store the output.  The entry is
+ * written under a temporary name and renamed into place, so readers never
+ * see part of one.
+ *
+ * @param  config  The program configuration.
+ * @param  input   The display filter input, from the first PGP block on.
+ * @param  len     The size of the input in bytes.
+ * @return         Zero, or -1 if nothing was stored.
+ */
+int cache_store(const program_config *config, const char *input, size_t len)
+{
+	int f, status;
+	char *dir, *path, *tmp, name[32], hdr[HEADER_LEN];
+	char settings[SETTINGS_LEN];
+	off_t end;
+	pinegpg_sink sink;
+	outbuf out;
+
+	dir = cache_path(NULL);
+	if (dir == NULL)
+		return -1;
+
+	if (mkdir(dir, S_IRWXU) == -1 && errno != EEXIST) {
+		free(dir);
+		return -1;
+	}
+	free(dir);
+
+	snprintf(name, sizeof (name), ".tmp.%ld", (long) getpid());
+	cache_settings(config, settings, sizeof (settings));
+	path = entry_path(settings, input, len);
+	tmp = cache_path(name);
+	if (path == NULL || tmp == NULL)
+		goto fail;
+
+	f = open(tmp, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (f == -1)
+		goto fail;
+
+	memset(hdr, ' ', sizeof (hdr));
+
+	out_init(&out, f, config->result_file);
+	out_write(&out, hdr, sizeof (hdr));
+	out_write(&out, input, len);
+
+	/* The entry is a file, so repeated blocks are copied as usual. */
+	out_sink(&out, &sink, 1);
+
+	status = pinegpg_transform(&config->lib, input, len, &sink);
+	out_free(&out);
+
+	end = lseek(f, 0, SEEK_END);
+	if (status != PINEGPG_OK || end == -1) {
+		/* GPG's own failure is not a system error. */
+		if (status == PINEGPG_ERR_GPG)
+			errno = 0;
+		close(f);
+		unlink(tmp);
+		goto fail;
+	}
+
+	snprintf(hdr, sizeof (hdr), "pine.gpg-cache 2 %lu %lu %s",
+		 (unsigned long) len,
+		 (unsigned long) (end - HEADER_LEN - len), settings);
+
+	if (pwrite(f, hdr, strlen(hdr), 0) != (ssize_t) strlen(hdr) ||
+	    close(f) == -1 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		goto fail;
+	}
+
+	free(path);
+	free(tmp);
+
+	return 0;
+
+fail:
+	free(path);
+	free(tmp);
+
+	return -1;
+}
+
+/**
+ * Remove entries older than CACHE_MAX_AGE days, and temporary files left
+ * by a warmer that was killed.
+ *
+ * @return  Nothing.
+ */
+void cache_prune(void)
+{
+	char *dir, *path;
+	DIR *d;
+	struct dirent *de;
+	struct stat sbuf;
+	time_t oldest = time(NULL) - CACHE_MAX_AGE * 24 * 60 * 60;
+
+	dir = cache_path(NULL);
+	if (dir == NULL)
+		return;
+
+	d = opendir(dir);
+	free(dir);
+	if (d == NULL)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+
+		path = cache_path(de->d_name);
+		if (path != NULL && stat(path, &sbuf) == 0 &&
+		    S_ISREG(sbuf.st_mode) &&
+		    (sbuf.st_mtime < oldest ||
+		     (de->d_name[0] == '.' &&
+		      sbuf.st_mtime < time(NULL) - 60 * 60)))
+			unlink(path);
+		free(path);
+	}
+
+	closedir(d);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * cache.h - Store of pre-rendered display filter output.
+ */
+
+#include "pinegpg.h"
+#include "utility.h"
+
+#ifndef CACHE_H
+#define CACHE_H 1
+
+#include <stddef.h>
+
+/* Entries older than this many days are pruned by the warmer. */
+#define CACHE_MAX_AGE 30
+
+int  cache_copy(const program_config *, const char *, size_t, outbuf *);
+int  cache_store(const program_config *, const char *, size_t);
+void cache_prune(void);
+
+#endif /* CACHE_H */
@@ -21,6 +21,6 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H 1
 
-void display(const pinegpg_config *);
+void display(const program_config *);
 
 #endif /* DISPLAY_H */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * import.c - Import filter.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "libpinegpg.h"
+#include "pinegpg.h"
+#include "scan.h"
+#include "utility.h"
+
+/**
+ * Import filter for the public keys of key distribution mails and keyring
+ * digests: every key block goes to a single GPG run, and the results for
+ * each key are shown in place of the blocks.
+ *
+ * @param  config  The program configuration.
+ * @return         Nothing.
+ */
+void import(const program_config *config)
+{
+	int f, status;
+	const char *e;
+	char *input;
+	ssize_t input_size;
+	struct stat sbuf;
+	pinegpg_block blk;
+	pinegpg_sink sink;
+	outbuf out;
+
+	const char *result_ok    = "Import filter completed successfully.",
+		   *result_empty = "Import filter skipped empty input.",
+		   *result_none  = "Import filter found no public key blocks.";
+
+	if (config->streaming) {
+		f = 1;
+		input = read_stream(0, &input_size, config->result_file);
+		if (input_size == 0)
+			die_x(EXIT_SUCCESS, 0, config->result_file,
+			      result_empty);
+	} else {
+		if (stat(config->input_file, &sbuf) == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to get size of input file");
+
+		input_size = sbuf.st_size;
+		if (input_size == 0)
+			die_x(EXIT_SUCCESS, 0, config->result_file,
+			      result_empty);
+
+		f = open(config->input_file, O_RDWR);
+		if (f == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to open input file for read/write");
+
+		input = read_input(f, input_size, config->result_file);
+	}
+
+	e = input + input_size;
+
+	/* As in the display filter, only the file from the first key block
+	 * onward is rewritten.
+	 */
+	if (!find_block(input, input, e, PGP_KEYS, &blk)) {
+		if (config->streaming) {
+			out_init(&out, f, config->result_file);
+			out_write(&out, input, input_size);
+			out_free(&out);
+		}
+		close(f);
+		die_x(EXIT_SUCCESS, 0, config->result_file, result_none);
+	}
+
+	if (!config->streaming) {
+		if (lseek(f, blk.begin - input, SEEK_SET) == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to seek to first key block in input file");
+
+		if (ftruncate(f, blk.begin - input) == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to truncate input file");
+	}
+
+	out_init(&out, f, config->result_file);
+	out_sink(&out, &sink, 0);
+
+	if (config->streaming)
+		out_write(&out, input, blk.begin - input);
+
+	status = pinegpg_import(&config->lib, blk.begin, e - blk.begin, &sink);
+	if (status != PINEGPG_OK)
+		die_x(EXIT_FAILURE, (status == PINEGPG_ERR_SYSTEM) ? errno : 0,
+		      config->result_file, "Import filter failed: %s",
+		      pinegpg_strerror(status));
+
+	out_free(&out);
+
+	close(f);
+
+	die_x(EXIT_SUCCESS, 0, config->result_file, result_ok);
+}
@@ -0,0 +1,1650 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * libpinegpg.c - Embeddable PINE.GPG library.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "libpinegpg.h"
+#include "packet.h"
+#include "pinegpg.h"
+#include "probes.h"
+#include "proc.h"
+#include "scan.h"
+#include "slots.h"
+#include "trace.h"
+
+/*
+ * Reply chains and forwards often carry the same PGP block more than once.
+ * Each block is hashed as it is found, and GPG is only run on the first
+ * copy; later copies are given the same output through the sink's copy()
+ * followed by a note.  Without tell() and copy() every copy is still run
+ * through GPG.
+ */
+typedef struct _seen_block {
+	unsigned long hash;
+	const char    *begin;
+	size_t        len;
+	off_t         out_begin;	/* sink offset of its TOP line */
+	size_t        out_len;		/* TOP line through END line */
+	long          out_bytes;	/* GPG output counted by the limits */
+} seen_block;
+
+/* Arrays, so that their lengths are known at compile time. */
+static const char trl[] = "--[PINE.GPG]--------------------------"
+			  "-------------------------------[TOP]--\n",
+		  grl[] = "--[PINE.GPG]--------------------------"
+			  "-------------------------------[GPG]--\n",
+		  erl[] = "--[PINE.GPG]--------------------------"
+			  "-------------------------------[END]--\n",
+		  reused[] = "  [PINE.GPG] Same block as above; GPG output "
+			     "reused\n";
+
+/**
+ * Describe a library status code.
+ *
+ * @param  status  The status returned by a libpinegpg function.
+ * @return         A static description of it.
+ */
+const char *pinegpg_strerror(int status)
+{
+	switch (status) {
+	case PINEGPG_OK:          return "Success";
+	case PINEGPG_ERR_SYSTEM:  return "System error";
+	case PINEGPG_ERR_GPG:     return "GPG failed";
+	case PINEGPG_ERR_SINK:    return "Output refused";
+	case PINEGPG_ERR_INVALID: return "Invalid argument";
+	}
+
+	return "Unknown error";
+}
+
+/**
+ * Find the complete PGP blocks of every armor type in a buffer.
+ *
+ * @param  input   The data to scan.
+ * @param  len     The size of the data in bytes.
+ * @param  blocks  Filled in with up to max blocks, in order.
+ * @param  max     The number of entries in blocks.
+ * @return         The number of blocks in the data, which may be more than
+ *                 max.
+ */
+int pinegpg_scan(const char *input, size_t len, pinegpg_block *blocks, int max)
+{
+	int n = 0;
+	const char *p = input, *e = input + len;
+	pinegpg_block blk;
+
+	while (find_block(input, p, e, PGP_ANY, &blk)) {
+		if (n < max)
+			blocks[n] = blk;
+		n++;
+		p = blk.end;
+	}
+
+	return n;
+}
+
+/**
+ * Pass output to the sink.
+ *
+ * @param  sink  The sink.
+ * @param  data  The data.
+ * @param  len   The size of the data in bytes.
+ * @return       PINEGPG_OK, or PINEGPG_ERR_SINK if the sink refused it.
+ */
+static int emit(const pinegpg_sink *sink, const char *data, size_t len)
+{
+	if (len == 0 || sink->write(sink->ctx, data, len) == 0)
+		return PINEGPG_OK;
+
+	return PINEGPG_ERR_SINK;
+}
+
+/**
+ * Close whichever ends of a set of pipes are still open.
+ *
+ * @param  fds  The pipes, with closed ends set to -1.
+ * @param  nr   The number of pipes.
+ * @return      Nothing.
+ */
+static void close_pipes(int (*fds)[2], int nr)
+{
+	int i, j, e = errno;
+
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < 2; j++) {
+			if (fds[i][j] != -1)
+				close(fds[i][j]);
+			fds[i][j] = -1;
+		}
+	}
+
+	errno = e;
+}
+
+/**
+ * Take the process name GPG is run under from the configured path.
+ *
+ * @param  config  The program configuration.
+ * @return         The last component of the path.
+ */
+static char *gpg_name(const pinegpg_config *config)
+{
+	char *p;
+
+	p = strrchr(config->gpg, '/');
+
+	return (p == NULL) ? config->gpg : p + 1;
+}
+
+/**
+ * Start GPG with the given pipes as its stdin and stdout, and stderr too
+ * if perr is not NULL.  All other pipe ends are closed in the child.
+ *
+ * @param  config  The program configuration.
+ * @param  args    A list of arguments to be passed to gpg(1).
+ * @param  fds     The pipes: stdin, stdout, then stderr if perr.
+ * @param  nr      The number of pipes.
+ * @return         The process ID of GPG, or -1 with errno set.
+ */
+static pid_t start_gpg(const pinegpg_config *config, char * const *args,
+		       int (*fds)[2], int nr)
+{
+	int i;
+	pid_t pid;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	for (i = 0; i < nr; i++) {
+		if (dup2(fds[i][i == 0 ? 0 : 1], i) == -1)
+			_exit(127);
+	}
+
+	close_pipes(fds, nr);
+
+	if (limit_gpg(config) == -1)
+		_exit(127);
+
+	execv(config->gpg, args);
+
+	note_x(config, "Failed to execv(%s): %s", config->gpg,
+	       strerror(errno));
+	_exit(127);
+}
+
+/**
+ * Decrypt and/or verify one PGP block, writing GPG's output between the
+ * TOP, GPG, and END lines.  GPG's own failures are reported in the output
+ * so that the user can see them.
+ *
+ * @param  config       The program configuration.
+ * @param  gpg_args     A list of arguments to be passed to gpg(1).
+ * @param  input        The data to decrypt/verify.
+ * @param  input_len    The size of the data in bytes.
+ * @param  sink         Where the output goes.
+ * @param  buf          A locked buffer of BUF_SIZE bytes for plaintext.
+ * @param  message_out  Running count of GPG output bytes for the message.
+ * @param  tr           The trace of this call.
+ * @return              A pinegpg_status.
+ */
+static int decrypt_block(const pinegpg_config *config, char * const *gpg_args,
+			 const char *input, size_t input_len,
+			 const pinegpg_sink *sink, char *buf,
+			 long *message_out, trace *tr)
+{
+	int i, s, e, slot, truncated = 0, status = PINEGPG_OK;
+	int fds[3][2] = { { -1, -1 }, { -1, -1 }, { -1, -1 } };
+	const char *limit_name = NULL;
+	long limit_value = 0;
+	pid_t pid[2];
+	struct rusage ru;
+	char c, errmsg[128];
+	ssize_t bytes_read;
+	size_t max;
+	long allowed = -1, block_out = 0;
+	struct timeval start, end;
+
+	if (config->max_block > 0) {
+		allowed = config->max_block;
+		limit_name = "per-block";
+		limit_value = config->max_block;
+	}
+
+	if (config->max_message > 0 &&
+	    (allowed == -1 || config->max_message - *message_out < allowed)) {
+		allowed = config->max_message - *message_out;
+		limit_name = "per-message";
+		limit_value = config->max_message;
+	}
+
+	/* Don't bother running GPG if there is nothing left to show. */
+	if (allowed == 0) {
+		snprintf(errmsg, sizeof (errmsg),
+			 "  [PINE.GPG] Block skipped: %s limit of %ld bytes "
+			 "reached\n", limit_name, limit_value);
+		if (emit(sink, trl, sizeof (trl) - 1) ||
+		    emit(sink, errmsg, strlen(errmsg)) ||
+		    emit(sink, erl, sizeof (erl) - 1))
+			return PINEGPG_ERR_SINK;
+		return PINEGPG_OK;
+	}
+
+	if (slot_acquire(config, &slot) == -1)
+		return PINEGPG_ERR_SYSTEM;
+
+	if (pipe_cloexec(fds[0]) == -1) {
+		slot_release(slot);
+		return PINEGPG_ERR_SYSTEM;
+	}
+
+	pid[0] = start_feeder(input, input_len, fds[0]);
+	if (pid[0] == -1) {
+		close_pipes(fds, 3);
+		slot_release(slot);
+		return PINEGPG_ERR_SYSTEM;
+	}
+	fds[0][1] = -1;
+
+	/* Made after the fork so that the feeder holds no write end of them. */
+	for (i = 1; i < 3; i++) {
+		if (pipe_cloexec(fds[i]) == -1)
+			break;
+	}
+
+	PROBE_CLOCK(start);
+
+	pid[1] = (i < 3) ? -1 : start_gpg(config, gpg_args, fds, 3);
+	if (pid[1] == -1) {
+		e = errno;
+		kill(pid[0], SIGKILL);
+		wait_child(pid[0], &s, NULL);
+		close_pipes(fds, 3);
+		slot_release(slot);
+		errno = e;
+		return PINEGPG_ERR_SYSTEM;
+	}
+
+	PROBE2(gpg__spawn, pid[1], (long) input_len);
+	trace_spawn(tr, pid[1], gpg_args);
+
+	close(fds[0][0]);
+	close(fds[1][1]);
+	close(fds[2][1]);
+	fds[0][0] = fds[1][1] = fds[2][1] = -1;
+
+	status = emit(sink, trl, sizeof (trl) - 1);
+
+	while (status == PINEGPG_OK) {
+		/* Once the limit is reached, peek for one more byte to tell a
+		 * block that fits exactly from one that has to be truncated.
+		 */
+		if (allowed != -1 && block_out == allowed) {
+			while ((bytes_read = read(fds[1][0], &c, 1)) == -1 &&
+			       errno == EINTR)
+				;
+			truncated = (bytes_read != 0);
+			break;
+		}
+
+		/* A sink that can read takes the plaintext straight into its
+		 * own buffer; otherwise it passes through ours.
+		 */
+		max = (sink->read != NULL) ? (size_t) -1 : BUF_SIZE;
+		if (allowed != -1 && (size_t) (allowed - block_out) < max)
+			max = allowed - block_out;
+
+		if (sink->read != NULL)
+			bytes_read = sink->read(sink->ctx, fds[1][0], max);
+		else
+			bytes_read = read(fds[1][0], buf, max);
+		if (bytes_read == -1) {
+			if (errno == EINTR)
+				continue;
+			status = PINEGPG_ERR_SYSTEM;
+			break;
+		}
+		if (bytes_read == 0)
+			break;
+
+		if (sink->read == NULL)
+			status = emit(sink, buf, bytes_read);
+		block_out += bytes_read;
+		trace_fed(tr, pid[1], pid[0], input_len);
+	}
+
+	*message_out += block_out;
+
+	PROBE2(gpg__stdout__done, pid[1], block_out);
+	trace_io(tr, pid[1], 1, NULL, block_out);
+
+	/* Stop GPG (and its feeder) from producing any more output, and if
+	 * it was cut off by a limit tell the user why the rest is missing.
+	 */
+	if (truncated || status != PINEGPG_OK) {
+		e = errno;
+		kill(pid[1], SIGKILL);
+		kill(pid[0], SIGKILL);
+		errno = e;
+	}
+
+	if (truncated) {
+		snprintf(errmsg, sizeof (errmsg),
+			 "\n  [PINE.GPG] Output truncated: %s limit of %ld "
+			 "bytes reached\n", limit_name, limit_value);
+		status = emit(sink, errmsg, strlen(errmsg));
+	}
+
+	close(fds[1][0]);
+	fds[1][0] = -1;
+
+	if (status == PINEGPG_OK)
+		status = emit(sink, grl, sizeof (grl) - 1);
+
+	while (status == PINEGPG_OK) {
+		bytes_read = read(fds[2][0], buf, BUF_SIZE);
+		if (bytes_read == -1) {
+			if (errno == EINTR)
+				continue;
+			status = PINEGPG_ERR_SYSTEM;
+			break;
+		}
+		if (bytes_read == 0)
+			break;
+
+		trace_io(tr, pid[1], 2, buf, bytes_read);
+		status = emit(sink, buf, bytes_read);
+	}
+
+	if (status != PINEGPG_OK) {
+		e = errno;
+		kill(pid[1], SIGKILL);
+		kill(pid[0], SIGKILL);
+		errno = e;
+	}
+
+	close_pipes(fds, 3);
+
+	/* Write these errors to the output so that the user can see them.
+	 * If the filter failed instead, then the MUA would not show any
+	 * filtered text and the user would not be able to see the problem.
+	 */
+	for (i = 0; i < 2; i++) {
+		if (wait_child(pid[i], &s, (i == 1) ? &ru : NULL) == -1) {
+			snprintf(errmsg, sizeof (errmsg),
+				 "  [PINE.GPG] Failed to reap %s child "
+				 "process %d\n", (i ? "GPG" : "feeder"),
+				 (int) pid[i]);
+			if (status == PINEGPG_OK)
+				status = emit(sink, errmsg, strlen(errmsg));
+			continue;
+		}
+
+		if (i == 0) {
+			PROBE2(feeder__exit, pid[0], s);
+			trace_fed(tr, pid[1], -1, input_len);
+		} else {
+			PROBE_CLOCK(end);
+			PROBE3(gpg__exit, pid[1], s, PROBE_USECS(start, end));
+			trace_exit(tr, pid[1], s, &ru);
+		}
+
+		if (status != PINEGPG_OK)
+			continue;
+
+		if (WIFSIGNALED(s) && WTERMSIG(s) &&
+		    !(truncated && WTERMSIG(s) == SIGKILL)) {
+			snprintf(errmsg, sizeof (errmsg),
+				 "  [PINE.GPG] %s terminated by signal %d\n",
+				 (i ? "GPG process" : "Feeder sub-process"),
+				 WTERMSIG(s));
+			status = emit(sink, errmsg, strlen(errmsg));
+		}
+
+		/* GPG exits with a status of one (1) if signature
+		 * verification fails.  A status of greater than one (1)
+		 * indicates a "real" error.
+		 */
+		if (WIFEXITED(s) && ((i == 0 && WEXITSTATUS(s) > 0) ||
+				     (i == 1 && WEXITSTATUS(s) > 1))) {
+			if (config->unattended) {
+				status = PINEGPG_ERR_GPG;
+				continue;
+			}
+			snprintf(errmsg, sizeof (errmsg),
+				 "  [PINE.GPG] %s exited with status %d\n",
+				 (i ? "GPG process" : "Feeder sub-process"),
+				 WEXITSTATUS(s));
+			status = emit(sink, errmsg, strlen(errmsg));
+		}
+	}
+
+	slot_release(slot);
+
+	if (status == PINEGPG_OK)
+		status = emit(sink, erl, sizeof (erl) - 1);
+
+	return status;
+}
+
+/**
+ * Look for an earlier copy of a PGP block.
+ *
+ * @param  seen     The blocks run through GPG so far.
+ * @param  nr_seen  The number of entries in seen.
+ * @param  blk      The block.
+ * @param  hash     The hash of the block.
+ * @return          The earlier copy, or NULL if there is none.
+ */
+static const seen_block *find_seen(const seen_block *seen, int nr_seen,
+				   const pinegpg_block *blk, unsigned long hash)
+{
+	int i;
+	size_t len = blk->end - blk->begin;
+
+	for (i = 0; i < nr_seen; i++) {
+		if (seen[i].hash == hash && seen[i].len == len &&
+		    memcmp(seen[i].begin, blk->begin, len) == 0)
+			return &seen[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Display filter transform: copy a message to the sink with each PGP block
+ * replaced by GPG's decrypted and/or verified output.
+ *
+ * @param  config  The program configuration.
+ * @param  input   The message.
+ * @param  len     The size of the message in bytes.
+ * @param  sink    Where the output goes.
+ * @return         A pinegpg_status; PINEGPG_ERR_GPG if GPG failed on a
+ *                 block and the configuration is unattended.
+ */
+int pinegpg_transform(const pinegpg_config *config, const char *input,
+		      size_t len, const pinegpg_sink *sink)
+{
+	int e, i = 0, nr_seen = 0, max_seen = 0, status = PINEGPG_OK;
+	int reuse = (sink->tell != NULL && sink->copy != NULL);
+	const char *p = input, *end = input + len;
+	char *buf, *gpg_args[10];
+	long message_out = 0, before;
+	unsigned long hash = 0;
+	seen_block *seen = NULL, *grown;
+	const seen_block *dup;
+	off_t out_begin = -1, out_end;
+	pinegpg_block blk;
+	trace tr;
+
+	gpg_args[i++] = gpg_name(config);
+
+	/* Trust database maintenance is left to pine.gpg -T. */
+	gpg_args[i++] = "--no-auto-check-trustdb";
+
+	if (config->unattended) {
+		gpg_args[i++] = "--batch";
+		gpg_args[i++] = "--pinentry-mode";
+		gpg_args[i++] = "cancel";
+	}
+
+	if (config->verbose > 0)
+		gpg_args[i++] = "--verbose";
+
+	if (config->verbose > 1)
+		gpg_args[i++] = "--verbose";
+	/*
+	 * This should be --decrypt for both decryption and signature
+	 * verification.  Using --verify does not print out the verified
+	 * (and unescaped) data.
+	 */
+	gpg_args[i++] = "--decrypt";
+	gpg_args[i++] = "-";
+	gpg_args[i++] = NULL;
+
+	/* Plaintext passes through here on its way to the sink, so keep it
+	 * out of swap.
+	 */
+	buf = calloc(1, BUF_SIZE);
+	if (buf == NULL)
+		return PINEGPG_ERR_SYSTEM;
+
+	if (mlock(buf, BUF_SIZE) == -1) {
+		free(buf);
+		return PINEGPG_ERR_SYSTEM;
+	}
+
+	trace_open(&tr, config, TRACE_TRANSFORM, 0, len);
+
+	while (status == PINEGPG_OK &&
+	       find_block(input, p, end, PGP_FILTERED, &blk)) {
+		PROBE3(block__found, (long) (blk.begin - input),
+		       (long) (blk.end - blk.begin), (int) blk.type);
+
+		status = emit(sink, p, blk.begin - p);
+		if (status != PINEGPG_OK)
+			break;
+		p = blk.end;
+
+		dup = NULL;
+		if (reuse) {
+			hash = block_hash(blk.begin, blk.end - blk.begin);
+			dup = find_seen(seen, nr_seen, &blk, hash);
+		}
+
+		trace_block(&tr, blk.begin - input, blk.end - blk.begin,
+			    blk.type, dup ? dup->begin - input + 1 : 0);
+
+		/* The copy counts against the per-message limit just as the
+		 * first did; if it no longer fits, GPG decides what to show.
+		 */
+		if (dup != NULL && (config->max_message == 0 ||
+				    message_out + dup->out_bytes <=
+				    config->max_message)) {
+			PROBE2(block__reused, (long) (blk.begin - input),
+			       (long) (blk.end - blk.begin));
+			if (sink->copy(sink->ctx, dup->out_begin,
+				       dup->out_len - (sizeof (erl) - 1)) != 0)
+				status = PINEGPG_ERR_SINK;
+			else if ((status = emit(sink, reused,
+						sizeof (reused) - 1)) ==
+				 PINEGPG_OK)
+				status = emit(sink, erl, sizeof (erl) - 1);
+			message_out += dup->out_bytes;
+			continue;
+		}
+
+		if (reuse)
+			out_begin = sink->tell(sink->ctx);
+
+		before = message_out;
+		status = decrypt_block(config, gpg_args, blk.begin,
+				       blk.end - blk.begin, sink, buf,
+				       &message_out, &tr);
+
+		if (status != PINEGPG_OK || !reuse || dup != NULL ||
+		    out_begin == -1)
+			continue;
+
+		out_end = sink->tell(sink->ctx);
+		if (out_end == -1)
+			continue;
+
+		if (nr_seen == max_seen) {
+			max_seen = max_seen ? max_seen * 2 : 8;
+			grown = realloc(seen, sizeof (seen_block) * max_seen);
+			if (grown == NULL) {
+				status = PINEGPG_ERR_SYSTEM;
+				break;
+			}
+			seen = grown;
+		}
+
+		seen[nr_seen].hash = hash;
+		seen[nr_seen].begin = blk.begin;
+		seen[nr_seen].len = blk.end - blk.begin;
+		seen[nr_seen].out_begin = out_begin;
+		seen[nr_seen].out_len = out_end - out_begin;
+		seen[nr_seen].out_bytes = message_out - before;
+		nr_seen++;
+	}
+
+	if (status == PINEGPG_OK)
+		status = emit(sink, p, end - p);
+
+	trace_close(&tr);
+
+	e = errno;
+	free(seen);
+	munlock(buf, BUF_SIZE);
+	free(buf);
+	errno = e;
+
+	return status;
+}
+
+/*
+ * A PGP/MIME signed message (RFC 3156) is the message itself as the first
+ * part of a multipart/signed wrapper, and GPG's detached signature as the
+ * second.  GPG is fed the signed part straight from the caller's buffer,
+ * and only the signature is kept: the wrapper's headers name its hash
+ * algorithm, so nothing is given to the sink until GPG is done.
+ *
+ * The signed part must be 7-bit, since a relay that converts it breaks the
+ * signature.  A body that is not is quoted-printable encoded first, which
+ * takes a copy of it; one that is goes out untouched.
+ */
+#define MAX_SIGNATURE 65536
+#define MAX_LINE      998
+#define QP_LINE       76
+#define QP_FIELD      "Content-Transfer-Encoding: quoted-printable\n"
+
+typedef struct _capture {
+	char   *buf;
+	size_t len;
+} capture;
+
+static const struct {
+	int        algo;
+	const char *name;
+} micalgs[] = {
+	{ 1, "pgp-md5" },     { 2, "pgp-sha1" },      { 3, "pgp-ripemd160" },
+	{ 8, "pgp-sha256" },  { 9, "pgp-sha384" },    { 10, "pgp-sha512" },
+	{ 11, "pgp-sha224" }, { 12, "pgp-sha3-256" }, { 14, "pgp-sha3-512" }
+};
+
+static int capture_write(void *ctx, const char *data, size_t len)
+{
+	capture *c = ctx;
+
+	if (len > MAX_SIGNATURE - c->len)
+		return -1;
+
+	memcpy(c->buf + c->len, data, len);
+	c->len += len;
+
+	return 0;
+}
+
+/**
+ * Find the end of a header field, continuation lines and all.
+ *
+ * @param  p  The start of the field.
+ * @param  e  The end of the headers.
+ * @return    The start of the next field.
+ */
+static const char *field_end(const char *p, const char *e)
+{
+	for (;;) {
+		p = memchr(p, '\n', e - p);
+		if (p == NULL)
+			return e;
+		if (++p == e || (*p != ' ' && *p != '\t'))
+			return p;
+	}
+}
+
+/**
+ * Tell whether a header field has the given name, or starts with it if
+ * the name ends with a dash.
+ *
+ * @param  p     The start of the field.
+ * @param  e     The end of the field.
+ * @param  name  The field name.
+ * @return       One if it does, or zero if not.
+ */
+static int field_is(const char *p, const char *e, const char *name)
+{
+	size_t n = strlen(name);
+
+	if ((size_t) (e - p) <= n || strncasecmp(p, name, n) != 0)
+		return 0;
+
+	return name[n - 1] == '-' || p[n] == ':';
+}
+
+/**
+ * Tell whether a MIME boundary delimiter line appears in a body.
+ *
+ * @param  p         The body.
+ * @param  e         The end of the body.
+ * @param  boundary  The boundary.
+ * @return           One if it does, or zero if not.
+ */
+static int has_delimiter(const char *p, const char *e, const char *boundary)
+{
+	size_t n = strlen(boundary);
+
+	while (p < e) {
+		if ((size_t) (e - p) >= n + 2 && p[0] == '-' && p[1] == '-' &&
+		    memcmp(p + 2, boundary, n) == 0)
+			return 1;
+
+		p = memchr(p, '\n', e - p);
+		if (p == NULL)
+			break;
+		p++;
+	}
+
+	return 0;
+}
+
+/**
+ * Tell whether a header field's value starts with the given text.
+ *
+ * @param  p      The start of the field.
+ * @param  e      The end of the field.
+ * @param  value  The text, in lower case.
+ * @return        One if it does, or zero if not.
+ */
+static int field_value_is(const char *p, const char *e, const char *value)
+{
+	size_t n = strlen(value);
+
+	p = memchr(p, ':', e - p);
+	if (p == NULL)
+		return 0;
+
+	for (p++; p < e && (*p == ' ' || *p == '\t'); p++)
+		;
+
+	return (size_t) (e - p) >= n && strncasecmp(p, value, n) == 0;
+}
+
+/**
+ * Tell whether a body will pass through mail relays unchanged: 7-bit, no
+ * line longer than MAX_LINE, no white space at the end of a line, and no
+ * line starting with "From ", which mbox delivery quotes.
+ *
+ * @param  p  The body.
+ * @param  e  The end of the body.
+ * @return    One if it will, or zero if not.
+ */
+static int body_is_7bit(const char *p, const char *e)
+{
+	const char *nl, *q;
+
+	for (; p < e; p = nl + 1) {
+		nl = memchr(p, '\n', e - p);
+		if (nl == NULL)
+			nl = e;
+
+		q = (nl > p && nl[-1] == '\r') ? nl - 1 : nl;
+		if (q - p > MAX_LINE ||
+		    (q > p && (q[-1] == ' ' || q[-1] == '\t')) ||
+		    (q - p >= 5 && memcmp(p, "From ", 5) == 0))
+			return 0;
+
+		for (; p < q; p++) {
+			if (*p == '\0' || (unsigned char) *p > 127)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Quoted-printable encode a body (RFC 2045), keeping its line breaks.
+ *
+ * @param  p    The body.
+ * @param  e    The end of the body.
+ * @param  len  Set to the size of the encoded body in bytes.
+ * @return      The newly allocated encoded body, or NULL.
+ */
+static char *qp_encode(const char *p, const char *e, size_t *len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	unsigned char c;
+	const char *nl, *q;
+	char *out;
+	size_t col, n;
+
+	/* At most three bytes for each, and a soft break every 73. */
+	if ((size_t) (e - p) > ((size_t) -1 - 16) / 4)
+		return NULL;
+	out = malloc((e - p) * 4 + 16);
+	if (out == NULL)
+		return NULL;
+
+	*len = 0;
+	for (; p < e; p = nl) {
+		nl = memchr(p, '\n', e - p);
+		nl = (nl == NULL) ? e : nl + 1;
+		q = (nl > p && nl[-1] == '\n') ? nl - 1 : nl;
+		if (q > p && q[-1] == '\r')
+			q--;
+
+		/* A soft break can put any text at the start of a line, so
+		 * "From " is encoded wherever it is.
+		 */
+		for (col = 0; p < q; p++) {
+			c = *p;
+			n = (c >= 127 || c == '=' || (c < ' ' && c != '\t') ||
+			     ((c == ' ' || c == '\t') && p + 1 == q) ||
+			     (q - p >= 5 && memcmp(p, "From ", 5) == 0)) ?
+			    3 : 1;
+
+			if (col + n > QP_LINE - 1) {
+				out[(*len)++] = '=';
+				out[(*len)++] = '\n';
+				col = 0;
+			}
+
+			if (n == 3) {
+				out[(*len)++] = '=';
+				out[(*len)++] = hex[c >> 4];
+				out[(*len)++] = hex[c & 15];
+			} else
+				out[(*len)++] = c;
+			col += n;
+		}
+
+		memcpy(out + *len, q, nl - q);
+		*len += nl - q;
+	}
+
+	return out;
+}
+
+/**
+ * Wrap a message signed by GPG in a PGP/MIME multipart/signed message.
+ *
+ * @param  sink       Where the output goes.
+ * @param  input      The message.
+ * @param  sep        The blank line that ends its headers.
+ * @param  part       The signed part's headers: the Content- fields.
+ * @param  part_len   The size of the part's headers in bytes.
+ * @param  body       The signed part's body, from the blank line on.
+ * @param  e          The end of the body.
+ * @param  sig        The ASCII armored detached signature.
+ * @return            A pinegpg_status; PINEGPG_ERR_GPG if the signature
+ *                    can not be read.
+ */
+static int mime_wrap(const pinegpg_sink *sink, const char *input,
+		     const char *sep, const char *part, size_t part_len,
+		     const char *body, const char *e, const capture *sig)
+{
+	int algo, status;
+	char boundary[40], head[256];
+	const char *micalg = NULL, *p, *q;
+	unsigned char *data;
+	unsigned long h;
+	size_t i, len;
+
+	p = memchr(sig->buf, '\n', sig->len);
+	data = (p == NULL) ? NULL :
+	       armor_decode(p + 1, sig->buf + sig->len, &len);
+	if (data == NULL)
+		return PINEGPG_ERR_GPG;
+	algo = sig_hash_algo(data, len);
+	free(data);
+
+	for (i = 0; i < sizeof (micalgs) / sizeof (micalgs[0]); i++)
+		if (micalgs[i].algo == algo)
+			micalg = micalgs[i].name;
+	if (micalg == NULL)
+		return PINEGPG_ERR_GPG;
+
+	h = block_hash(sig->buf, sig->len);
+	do {
+		snprintf(boundary, sizeof (boundary), "=-=PINE.GPG-%08lx=-=",
+			 h & 0xffffffffUL);
+		h = h * 31 + 1;
+	} while (has_delimiter(body, e, boundary));
+
+	/* Everything but the Content- fields stays at the top level. */
+	for (p = input; p < sep; p = q) {
+		q = field_end(p, sep);
+		if (field_is(p, q, "Content-") ||
+		    field_is(p, q, "MIME-Version"))
+			continue;
+		status = emit(sink, p, q - p);
+		if (status != PINEGPG_OK)
+			return status;
+	}
+
+	snprintf(head, sizeof (head), "MIME-Version: 1.0\n"
+		 "Content-Type: multipart/signed; micalg=%s;\n"
+		 "\tprotocol=\"application/pgp-signature\";\n"
+		 "\tboundary=\"%s\"\n\n"
+		 "This is an OpenPGP/MIME signed message (RFC 3156).\n"
+		 "--%s\n", micalg, boundary, boundary);
+
+	if ((status = emit(sink, head, strlen(head))) != PINEGPG_OK ||
+	    (status = emit(sink, part, part_len)) != PINEGPG_OK ||
+	    (status = emit(sink, body, e - body)) != PINEGPG_OK)
+		return status;
+
+	snprintf(head, sizeof (head), "%s--%s\n"
+		 "Content-Type: application/pgp-signature; "
+		 "name=\"signature.asc\"\n"
+		 "Content-Description: OpenPGP digital signature\n\n",
+		 (e[-1] == '\n') ? "" : "\n", boundary);
+
+	if ((status = emit(sink, head, strlen(head))) != PINEGPG_OK ||
+	    (status = emit(sink, sig->buf, sig->len)) != PINEGPG_OK)
+		return status;
+
+	snprintf(head, sizeof (head), "%s--%s--\n",
+		 (sig->buf[sig->len - 1] == '\n') ? "" : "\n", boundary);
+
+	return emit(sink, head, strlen(head));
+}
+
+/**
+ * Run GPG to sign and/or encrypt data fed to it in spans, giving its
+ * output to the sink.
+ *
+ * @param  config      The program configuration.
+ * @param  gpg_args    A list of arguments to be passed to gpg(1).
+ * @param  iov         The spans of data.
+ * @param  nr          The number of spans.
+ * @param  len         The total size of the spans in bytes.
+ * @param  sink        Where the output goes.
+ * @param  gpg_status  Set to GPG's wait status if PINEGPG_OK is returned.
+ * @param  tr          The trace of this call.
+ * @return             A pinegpg_status; GPG's own failure is left to the
+ *                     caller.
+ */
+static int run_protect(const pinegpg_config *config, char * const *gpg_args,
+		       struct iovec *iov, int nr, size_t len,
+		       const pinegpg_sink *sink, int *gpg_status, trace *tr)
+{
+	int s, e, slot, status = PINEGPG_OK;
+	int fds[2][2] = { { -1, -1 }, { -1, -1 } };
+	char *buf;
+	ssize_t bytes;
+	size_t out_bytes = 0;
+	pid_t pid[2];
+	struct rusage ru;
+	struct timeval start, end;
+
+	buf = malloc(OUT_BUF_SIZE);
+	if (buf == NULL)
+		return PINEGPG_ERR_SYSTEM;
+
+	if (slot_acquire(config, &slot) == -1) {
+		status = PINEGPG_ERR_SYSTEM;
+		goto out;
+	}
+
+	if (pipe_cloexec(fds[0]) == -1) {
+		status = PINEGPG_ERR_SYSTEM;
+		goto out_slot;
+	}
+
+	pid[0] = start_feeder_iov(iov, nr, fds[0]);
+	if (pid[0] == -1) {
+		status = PINEGPG_ERR_SYSTEM;
+		goto out_slot;
+	}
+	fds[0][1] = -1;
+
+	PROBE_CLOCK(start);
+
+	pid[1] = -1;
+	if (pipe_cloexec(fds[1]) == 0)
+		pid[1] = start_gpg(config, gpg_args, fds, 2);
+	if (pid[1] == -1) {
+		e = errno;
+		kill(pid[0], SIGKILL);
+		wait_child(pid[0], &s, NULL);
+		errno = e;
+		status = PINEGPG_ERR_SYSTEM;
+		goto out_slot;
+	}
+
+	PROBE2(gpg__spawn, pid[1], (long) len);
+	trace_spawn(tr, pid[1], gpg_args);
+
+	close(fds[0][0]);
+	close(fds[1][1]);
+	fds[0][0] = fds[1][1] = -1;
+
+	for (;;) {
+		bytes = read(fds[1][0], buf, OUT_BUF_SIZE);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			status = PINEGPG_ERR_SYSTEM;
+			break;
+		}
+		if (bytes == 0)
+			break;
+
+		status = emit(sink, buf, bytes);
+		out_bytes += bytes;
+		if (status != PINEGPG_OK)
+			break;
+		trace_fed(tr, pid[1], pid[0], len);
+	}
+
+	trace_io(tr, pid[1], 1, NULL, out_bytes);
+
+	if (status != PINEGPG_OK) {
+		e = errno;
+		kill(pid[1], SIGKILL);
+		kill(pid[0], SIGKILL);
+		errno = e;
+	}
+
+	close_pipes(fds, 2);
+
+	e = errno;
+	if (wait_child(pid[0], &s, NULL) == 0)
+		trace_fed(tr, pid[1], -1, len);
+	if (wait_child(pid[1], &s, &ru) == -1) {
+		if (status == PINEGPG_OK) {
+			e = errno;
+			status = PINEGPG_ERR_SYSTEM;
+		}
+	} else {
+		PROBE_CLOCK(end);
+		PROBE3(gpg__exit, pid[1], s, PROBE_USECS(start, end));
+		trace_exit(tr, pid[1], s, &ru);
+	}
+	errno = e;
+
+	if (status == PINEGPG_OK)
+		*gpg_status = s;
+
+out_slot:
+	close_pipes(fds, 2);
+	slot_release(slot);
+out:
+	e = errno;
+	free(buf);
+	errno = e;
+
+	return status;
+}
+
+/**
+ * Sending filter transform: sign and/or encrypt a message with GPG, giving
+ * the ASCII armored result to the sink.  The output is only complete if
+ * PINEGPG_OK is returned, so a caller that must never send an unfiltered
+ * message should hold it until then.
+ *
+ * With PINEGPG_MIME_SIGN the message must be a whole one, headers and all,
+ * and the result is a PGP/MIME signed message with the body left as it
+ * was, or quoted-printable encoded if it was not fit for mail transport;
+ * nothing is given to the sink unless GPG succeeded.
+ *
+ * @param  config      The program configuration.
+ * @param  how         What to do to the message.
+ * @param  input       The message.
+ * @param  len         The size of the message in bytes.
+ * @param  sink        Where the output goes.
+ * @param  gpg_status  If not NULL, set to GPG's wait status.
+ * @return             A pinegpg_status; PINEGPG_ERR_INVALID if a message
+ *                     for PINEGPG_MIME_SIGN has no body, or one unfit
+ *                     for mail transport that can not be encoded: a
+ *                     multipart or message, or one already encoded.
+ */
+int pinegpg_protect(const pinegpg_config *config, pinegpg_how how,
+		    const char *input, size_t len, const pinegpg_sink *sink,
+		    int *gpg_status)
+{
+	int i, s = 0, e, status, encode = 0;
+	int arg_idx = 0, nr_args = 19 + config->nr_rcpts * 2;
+	char **gpg_args, *part = NULL, *body = NULL;
+	const char *p, *q, *sep = NULL, *end = input + len;
+	const char *body_begin = NULL, *body_end = NULL;
+	size_t part_len = 0, body_len;
+	struct iovec iov[2];
+	pinegpg_sink sig_sink;
+	capture sig;
+	trace tr;
+
+	if (how != PINEGPG_SIGN && how != PINEGPG_ENCRYPT &&
+	    how != PINEGPG_SIGN_ENCRYPT && how != PINEGPG_MIME_SIGN)
+		return PINEGPG_ERR_INVALID;
+
+	if ((how == PINEGPG_ENCRYPT || how == PINEGPG_SIGN_ENCRYPT) &&
+	    config->nr_rcpts < 1)
+		return PINEGPG_ERR_INVALID;
+
+	/* The signed part is the Content- fields, then the blank line and
+	 * the body, less the line break that belongs to the boundary after
+	 * it.
+	 */
+	if (how == PINEGPG_MIME_SIGN) {
+		for (p = input; p < end; p = q + 1) {
+			q = memchr(p, '\n', end - p);
+			if (q == NULL)
+				break;
+			if (q == p || (q == p + 1 && *p == '\r')) {
+				sep = p;
+				break;
+			}
+		}
+		if (sep == NULL)
+			return PINEGPG_ERR_INVALID;
+
+		/* Only a leaf part can be given a transfer encoding. */
+		encode = !body_is_7bit(sep, end);
+		for (p = input; encode && p < sep; p = q) {
+			q = field_end(p, sep);
+			if ((field_is(p, q, "Content-Type") &&
+			     (field_value_is(p, q, "multipart/") ||
+			      field_value_is(p, q, "message/"))) ||
+			    (field_is(p, q, "Content-Transfer-Encoding") &&
+			     !field_value_is(p, q, "7bit") &&
+			     !field_value_is(p, q, "8bit") &&
+			     !field_value_is(p, q, "binary")))
+				return PINEGPG_ERR_INVALID;
+		}
+	}
+
+	gpg_args = malloc(sizeof (char *) * nr_args);
+	sig.buf = NULL;
+	sig.len = 0;
+	if (how == PINEGPG_MIME_SIGN) {
+		sig.buf = malloc(MAX_SIGNATURE);
+		part = malloc(sep - input + sizeof (QP_FIELD));
+		body_begin = sep;
+		body_end = end;
+		if (encode) {
+			body = qp_encode(sep, end, &body_len);
+			body_begin = body;
+			if (body != NULL)
+				body_end = body + body_len;
+		}
+	}
+	if (gpg_args == NULL || (how == PINEGPG_MIME_SIGN &&
+				 (sig.buf == NULL || part == NULL ||
+				  body_begin == NULL))) {
+		free(gpg_args);
+		free(sig.buf);
+		free(part);
+		free(body);
+		return PINEGPG_ERR_SYSTEM;
+	}
+
+	gpg_args[arg_idx++] = gpg_name(config);
+	gpg_args[arg_idx++] = "--no-auto-check-trustdb";
+	gpg_args[arg_idx++] = "--armor";
+	gpg_args[arg_idx++] = "--set-filename";
+	gpg_args[arg_idx++] = "";
+	gpg_args[arg_idx++] = "--output";
+	gpg_args[arg_idx++] = "-";
+
+	if (config->unattended) {
+		gpg_args[arg_idx++] = "--batch";
+		gpg_args[arg_idx++] = "--pinentry-mode";
+		gpg_args[arg_idx++] = "cancel";
+	}
+
+	if (config->default_key != NULL) {
+		gpg_args[arg_idx++] = "--default-key";
+		gpg_args[arg_idx++] = config->default_key;
+	}
+
+	if (config->verbose > 0)
+		gpg_args[arg_idx++] = "--verbose";
+
+	if (config->verbose > 1)
+		gpg_args[arg_idx++] = "--verbose";
+
+	if (how == PINEGPG_SIGN)
+		gpg_args[arg_idx++] = "--clearsign";
+	else if (how == PINEGPG_MIME_SIGN) {
+		gpg_args[arg_idx++] = "--detach-sign";
+		gpg_args[arg_idx++] = "--textmode";
+	} else {
+		if (how == PINEGPG_SIGN_ENCRYPT)
+			gpg_args[arg_idx++] = "--sign";
+		gpg_args[arg_idx++] = "--encrypt";
+		for (i = 0; i < config->nr_rcpts; i++) {
+			gpg_args[arg_idx++] = "--recipient";
+			gpg_args[arg_idx++] = config->rcpts[i];
+		}
+	}
+
+	gpg_args[arg_idx++] = "-";
+	gpg_args[arg_idx++] = NULL;
+
+	iov[0].iov_base = (void *) input;
+	iov[0].iov_len = len;
+	iov[1].iov_len = 0;
+
+	if (how == PINEGPG_MIME_SIGN) {
+		for (p = input; p < sep; p = q) {
+			q = field_end(p, sep);
+			if (field_is(p, q, "Content-") &&
+			    !(encode &&
+			      field_is(p, q, "Content-Transfer-Encoding"))) {
+				memcpy(part + part_len, p, q - p);
+				part_len += q - p;
+			}
+		}
+
+		if (encode) {
+			memcpy(part + part_len, QP_FIELD, strlen(QP_FIELD));
+			part_len += strlen(QP_FIELD);
+		}
+
+		iov[0].iov_base = part;
+		iov[0].iov_len = part_len;
+		iov[1].iov_base = (void *) body_begin;
+		iov[1].iov_len = body_end - body_begin;
+		if (body_end[-1] == '\n')
+			iov[1].iov_len -= (iov[1].iov_len >= 2 &&
+					   body_end[-2] == '\r') ? 2 : 1;
+
+		sig_sink.write = capture_write;
+		sig_sink.tell = NULL;
+		sig_sink.copy = NULL;
+		sig_sink.read = NULL;
+		sig_sink.ctx = &sig;
+	}
+
+	len = iov[0].iov_len + iov[1].iov_len;
+
+	trace_open(&tr, config, TRACE_PROTECT, how, len);
+
+	status = run_protect(config, gpg_args, iov, 2, len,
+			     (how == PINEGPG_MIME_SIGN) ? &sig_sink : sink, &s,
+			     &tr);
+
+	if (status == PINEGPG_OK) {
+		if (gpg_status != NULL)
+			*gpg_status = s;
+		if (!WIFEXITED(s) || WEXITSTATUS(s) != 0)
+			status = PINEGPG_ERR_GPG;
+	}
+
+	if (status == PINEGPG_OK && how == PINEGPG_MIME_SIGN)
+		status = mime_wrap(sink, input, sep, part, part_len,
+				   body_begin, body_end, &sig);
+
+	trace_close(&tr);
+	e = errno;
+	free(gpg_args);
+	free(sig.buf);
+	free(part);
+	free(body);
+	errno = e;
+
+	return status;
+}
+
+/**
+ * Describe the flags of an IMPORT_OK status line.
+ *
+ * @param  flags  The flags.
+ * @param  buf    Where the description goes.
+ * @param  size   The size of buf in bytes.
+ * @return        Nothing.
+ */
+static void import_flags(unsigned long flags, char *buf, size_t size)
+{
+	int i;
+	size_t n = 0;
+	static const char *names[] = { "new key", "new user IDs",
+				       "new signatures", "new subkeys",
+				       "secret key" };
+
+	buf[0] = '\0';
+
+	for (i = 0; i < 5; i++) {
+		if ((flags & (1UL << i)) && n < size)
+			n += snprintf(buf + n, size - n, "%s%s",
+				      (n ? ", " : ""), names[i]);
+	}
+
+	if (n == 0)
+		snprintf(buf, size, "unchanged");
+}
+
+/**
+ * Write the per-key results of an import from GPG's status lines.
+ *
+ * @param  sink  Where the output goes.
+ * @param  out   GPG's status and log output.
+ * @param  len   The size of the output in bytes.
+ * @return       A pinegpg_status.
+ */
+static int import_report(const pinegpg_sink *sink, const char *out,
+			 size_t len)
+{
+	int i, n, status = PINEGPG_OK;
+	unsigned long code, res[14];
+	const char *p, *q, *e = out + len, *why;
+	char fpr[64], flags[80], line[192];
+	static const char *problems[] = { "no specific reason",
+					  "invalid certificate",
+					  "issuer certificate missing",
+					  "certificate chain too long",
+					  "error storing certificate" };
+
+	for (p = out; status == PINEGPG_OK && p < e; p = q + 1) {
+		q = memchr(p, '\n', e - p);
+		if (q == NULL)
+			q = e;
+
+		n = q - p;
+		if (n >= (int) sizeof (line) || n < 9 ||
+		    memcmp(p, "[GNUPG:] ", 9) != 0)
+			continue;
+
+		memcpy(line, p, n);
+		line[n] = '\0';
+
+		fpr[0] = '\0';
+		n = 0;
+
+		if (sscanf(line, "[GNUPG:] IMPORT_OK %lu %63s", &code,
+			   fpr) == 2) {
+			import_flags(code, flags, sizeof (flags));
+			n = snprintf(line, sizeof (line),
+				     "  [PINE.GPG] Key %s: %s\n", fpr, flags);
+		} else if (sscanf(line, "[GNUPG:] IMPORT_PROBLEM %lu %63s",
+				  &code, fpr) >= 1) {
+			why = (code < 5) ? problems[code] : "unknown problem";
+			n = snprintf(line, sizeof (line),
+				     "  [PINE.GPG] Key %s: not imported (%s)\n",
+				     (fpr[0] ? fpr : "(unknown)"), why);
+		} else if ((i = sscanf(line, "[GNUPG:] IMPORT_RES %lu %lu %lu "
+				       "%lu %lu %lu %lu %lu %lu %lu %lu %lu "
+				       "%lu %lu", &res[0], &res[1], &res[2],
+				       &res[3], &res[4], &res[5], &res[6],
+				       &res[7], &res[8], &res[9], &res[10],
+				       &res[11], &res[12], &res[13])) >= 5) {
+			n = snprintf(line, sizeof (line),
+				     "  [PINE.GPG] %lu keys processed: %lu "
+				     "imported, %lu unchanged, %lu not "
+				     "imported\n", res[0], res[2], res[4],
+				     (i == 14) ? res[13] : 0);
+		}
+
+		if (n > 0)
+			status = emit(sink, line, n);
+	}
+
+	return status;
+}
+
+/**
+ * Run one GPG import on the gathered key blocks, collecting its status and
+ * log output.
+ *
+ * @param  config   The program configuration.
+ * @param  keys     The key blocks.
+ * @param  len      The size of the key blocks in bytes.
+ * @param  out      Set to a newly allocated buffer of GPG's output.
+ * @param  out_len  Set to the size of the output in bytes.
+ * @param  s        Set to GPG's wait status.
+ * @param  tr       The trace of this call.
+ * @return          A pinegpg_status.
+ */
+static int run_import(const pinegpg_config *config, const char *keys,
+		      size_t len, char **out, size_t *out_len, int *s,
+		      trace *tr)
+{
+	int i = 0, e, slot, status = PINEGPG_OK;
+	int fds[2][2] = { { -1, -1 }, { -1, -1 } };
+	char *gpg_args[14], *grown;
+	size_t out_max = 0;
+	ssize_t bytes;
+	pid_t pid[2];
+	struct rusage ru;
+
+	gpg_args[i++] = gpg_name(config);
+	gpg_args[i++] = "--no-auto-check-trustdb";
+	gpg_args[i++] = "--batch";
+
+	/* Status lines give the result for each key; GPG's messages come
+	 * along on the same pipe so that reading it can never deadlock.
+	 */
+	gpg_args[i++] = "--status-fd";
+	gpg_args[i++] = "1";
+	gpg_args[i++] = "--logger-fd";
+	gpg_args[i++] = "1";
+
+	if (config->import_options != NULL) {
+		gpg_args[i++] = "--import-options";
+		gpg_args[i++] = config->import_options;
+	}
+
+	if (config->verbose > 0)
+		gpg_args[i++] = "--verbose";
+
+	if (config->verbose > 1)
+		gpg_args[i++] = "--verbose";
+
+	gpg_args[i++] = "--import";
+	gpg_args[i++] = NULL;
+
+	*out = NULL;
+	*out_len = 0;
+
+	if (slot_acquire(config, &slot) == -1)
+		return PINEGPG_ERR_SYSTEM;
+
+	if (pipe_cloexec(fds[0]) == -1) {
+		status = PINEGPG_ERR_SYSTEM;
+		goto out;
+	}
+
+	pid[0] = start_feeder(keys, len, fds[0]);
+	if (pid[0] == -1) {
+		status = PINEGPG_ERR_SYSTEM;
+		goto out;
+	}
+	fds[0][1] = -1;
+
+	pid[1] = -1;
+	if (pipe_cloexec(fds[1]) == 0)
+		pid[1] = start_gpg(config, gpg_args, fds, 2);
+	if (pid[1] == -1) {
+		e = errno;
+		kill(pid[0], SIGKILL);
+		wait_child(pid[0], s, NULL);
+		errno = e;
+		status = PINEGPG_ERR_SYSTEM;
+		goto out;
+	}
+
+	trace_spawn(tr, pid[1], gpg_args);
+
+	close(fds[0][0]);
+	close(fds[1][1]);
+	fds[0][0] = fds[1][1] = -1;
+
+	for (;;) {
+		if (*out_len == out_max) {
+			grown = realloc(*out, out_max + OUT_BUF_SIZE);
+			if (grown == NULL) {
+				status = PINEGPG_ERR_SYSTEM;
+				break;
+			}
+			*out = grown;
+			out_max += OUT_BUF_SIZE;
+		}
+
+		bytes = read(fds[1][0], *out + *out_len, out_max - *out_len);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			status = PINEGPG_ERR_SYSTEM;
+			break;
+		}
+		if (bytes == 0)
+			break;
+
+		*out_len += bytes;
+		trace_fed(tr, pid[1], pid[0], len);
+	}
+
+	trace_io(tr, pid[1], 1, NULL, *out_len);
+
+	if (status != PINEGPG_OK) {
+		e = errno;
+		kill(pid[1], SIGKILL);
+		kill(pid[0], SIGKILL);
+		errno = e;
+	}
+
+	close_pipes(fds, 2);
+
+	e = errno;
+	if (wait_child(pid[0], s, NULL) == 0)
+		trace_fed(tr, pid[1], -1, len);
+	if (wait_child(pid[1], s, &ru) == -1) {
+		if (status == PINEGPG_OK) {
+			e = errno;
+			status = PINEGPG_ERR_SYSTEM;
+		}
+	} else
+		trace_exit(tr, pid[1], *s, &ru);
+	errno = e;
+
+out:
+	close_pipes(fds, 2);
+	slot_release(slot);
+
+	return status;
+}
+
+/**
+ * Import filter transform: pass every public key block of a message to
+ * one GPG --import run.  The results for each key, then GPG's messages,
+ * replace the first key block between the TOP, GPG, and END lines; the
+ * other key blocks are left out, and the rest of the message is passed
+ * through.  A message without key blocks is passed through whole.
+ *
+ * @param  config  The program configuration.
+ * @param  input   The message.
+ * @param  len     The size of the message in bytes.
+ * @param  sink    Where the output goes.
+ * @return         A pinegpg_status.
+ */
+int pinegpg_import(const pinegpg_config *config, const char *input,
+		   size_t len, const pinegpg_sink *sink)
+{
+	int s = 0, nr_blocks = 0, nr_bad = 0, e, status = PINEGPG_OK;
+	const char *p, *q, *end = input + len;
+	char *keys, *out = NULL, errmsg[128];
+	unsigned char *data;
+	size_t keys_len = 0, data_len, out_len = 0;
+	pinegpg_block blk, first;
+	trace tr;
+
+	if (!find_block(input, input, end, PGP_KEYS, &first))
+		return emit(sink, input, len);
+
+	for (p = first.begin; find_block(input, p, end, PGP_KEYS, &blk);
+	     p = blk.end)
+		keys_len += blk.end - blk.begin;
+
+	/* Gather the key blocks so that GPG only has to start once.  Public
+	 * keys are not secret, so they need not be kept out of swap.
+	 */
+	keys = malloc(keys_len);
+	if (keys == NULL)
+		return PINEGPG_ERR_SYSTEM;
+
+	trace_open(&tr, config, TRACE_IMPORT, 0, len);
+
+	/* GPG gives up on the rest of its input at the first bad block, so
+	 * blocks that do not hold a public key are left out.
+	 */
+	for (keys_len = 0, p = first.begin;
+	     find_block(input, p, end, PGP_KEYS, &blk);
+	     p = blk.end) {
+		trace_block(&tr, blk.begin - input, blk.end - blk.begin,
+			    blk.type, 0);
+
+		data = armor_decode(memchr(blk.begin, '\n',
+					   blk.end - blk.begin) + 1,
+				    blk.end, &data_len);
+		if (data == NULL || !is_public_key(data, data_len)) {
+			free(data);
+			nr_bad++;
+			continue;
+		}
+		free(data);
+
+		memcpy(keys + keys_len, blk.begin, blk.end - blk.begin);
+		keys_len += blk.end - blk.begin;
+		nr_blocks++;
+	}
+
+	if (nr_blocks > 0) {
+		status = run_import(config, keys, keys_len, &out, &out_len,
+				    &s, &tr);
+		if (status != PINEGPG_OK)
+			goto out;
+	}
+
+	snprintf(errmsg, sizeof (errmsg), "  [PINE.GPG] %d public key "
+		 "block%s passed to one GPG import\n", nr_blocks,
+		 (nr_blocks == 1) ? "" : "s");
+
+	if (emit(sink, input, first.begin - input) ||
+	    emit(sink, trl, sizeof (trl) - 1) ||
+	    emit(sink, errmsg, strlen(errmsg))) {
+		status = PINEGPG_ERR_SINK;
+		goto out;
+	}
+
+	if (nr_bad > 0) {
+		snprintf(errmsg, sizeof (errmsg), "  [PINE.GPG] %d key "
+			 "block%s left out: not a public key\n", nr_bad,
+			 (nr_bad == 1) ? "" : "s");
+		status = emit(sink, errmsg, strlen(errmsg));
+	}
+
+	if (status != PINEGPG_OK || import_report(sink, out, out_len) ||
+	    emit(sink, grl, sizeof (grl) - 1)) {
+		status = PINEGPG_ERR_SINK;
+		goto out;
+	}
+
+	/* Then GPG's own messages, without the status lines. */
+	for (p = out; status == PINEGPG_OK && p < out + out_len; p = q) {
+		q = memchr(p, '\n', out + out_len - p);
+		q = (q == NULL) ? out + out_len : q + 1;
+		if (q - p < 9 || memcmp(p, "[GNUPG:] ", 9) != 0)
+			status = emit(sink, p, q - p);
+	}
+
+	if (status == PINEGPG_OK && WIFSIGNALED(s)) {
+		snprintf(errmsg, sizeof (errmsg), "  [PINE.GPG] GPG process "
+			 "terminated by signal %d\n", WTERMSIG(s));
+		status = emit(sink, errmsg, strlen(errmsg));
+	} else if (status == PINEGPG_OK && WEXITSTATUS(s) != 0) {
+		snprintf(errmsg, sizeof (errmsg), "  [PINE.GPG] GPG process "
+			 "exited with status %d\n", WEXITSTATUS(s));
+		status = emit(sink, errmsg, strlen(errmsg));
+	}
+
+	if (status == PINEGPG_OK)
+		status = emit(sink, erl, sizeof (erl) - 1);
+
+	for (p = first.end; status == PINEGPG_OK &&
+	     find_block(input, p, end, PGP_KEYS, &blk);
+	     p = blk.end)
+		status = emit(sink, p, blk.begin - p);
+
+	if (status == PINEGPG_OK)
+		status = emit(sink, p, end - p);
+
+out:
+	trace_close(&tr);
+	e = errno;
+	free(keys);
+	free(out);
+	errno = e;
+
+	return status;
+}
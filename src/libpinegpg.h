@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * libpinegpg.h - Embeddable PINE.GPG library.
+ */
+
+#ifndef LIBPINEGPG_H
+#define LIBPINEGPG_H 1
+
+#include <sys/types.h>
+
+/*
+ * The filters' scanner and GPG pipelines, for programs that would rather
+ * not fork pine.gpg once per message.  Nothing here exits or keeps state
+ * between calls: every function reports failure with a pinegpg_status
+ * (and errno for PINEGPG_ERR_SYSTEM), and all output goes to the caller's
+ * sink.
+ *
+ * GPG runs as a child process, so the caller must not reap children it
+ * did not start (no SIGCHLD set to SIG_IGN, no waitpid(-1, ...)).
+ */
+
+/*
+ * Every armor type of RFC 4880; the scanner's table is in scan.c.  A
+ * message split over several armored parts ("PART X/Y" or "PART X") is
+ * found one part at a time as PINEGPG_ARMOR_MESSAGE_PART, and the filters
+ * leave such parts as they are.
+ */
+typedef enum _pinegpg_armor {
+	PINEGPG_ARMOR_MESSAGE,
+	PINEGPG_ARMOR_SIGNED_MESSAGE,
+	PINEGPG_ARMOR_PUBLIC_KEY,
+	PINEGPG_ARMOR_PRIVATE_KEY,
+	PINEGPG_ARMOR_SIGNATURE,
+	PINEGPG_ARMOR_MESSAGE_PART
+} pinegpg_armor;
+
+typedef struct _pinegpg_block {
+	pinegpg_armor type;
+	const char    *begin;	/* first byte of the BEGIN line */
+	const char    *end;	/* one past the END line */
+} pinegpg_block;
+
+/* What pinegpg_protect() does to a message. */
+typedef enum _pinegpg_how {
+	PINEGPG_SIGN,		/* clearsign */
+	PINEGPG_ENCRYPT,
+	PINEGPG_SIGN_ENCRYPT,
+	PINEGPG_MIME_SIGN	/* PGP/MIME with a detached signature */
+} pinegpg_how;
+
+/*
+ * How GPG is run.  Zero limits mean no limit, and NULL trace_file means
+ * no trace.  Informational notes, such as the time spent waiting for a
+ * GPG slot, are given to note() with note_ctx, or dropped if it is NULL.
+ * Non-zero unattended means no user is there to give a passphrase: GPG
+ * never asks for one, and a block GPG fails on fails the whole transform
+ * instead of having the error shown in its place.
+ */
+typedef struct _pinegpg_config {
+	char **rcpts;
+	int  nr_rcpts;
+	char *gpg;
+	char *default_key;
+	int  verbose;
+	int  unattended;
+	int  max_gpg;
+	long max_block;
+	long max_message;
+	long max_cpu;
+	long max_as;
+	long max_fsize;
+	char *import_options;
+	char *trace_file;
+	int  trace_redact;
+	void (*note)(void *, const char *);
+	void *note_ctx;
+} pinegpg_config;
+
+typedef enum _pinegpg_status {
+	PINEGPG_OK = 0,
+	PINEGPG_ERR_SYSTEM,	/* a system call failed, see errno */
+	PINEGPG_ERR_GPG,	/* GPG failed, see its wait status */
+	PINEGPG_ERR_SINK,	/* the sink refused the output */
+	PINEGPG_ERR_INVALID	/* an argument was not valid */
+} pinegpg_status;
+
+/*
+ * Where output goes.  write() returns zero, or non-zero to stop.  tell()
+ * and copy() are optional: given both, a PGP block that repeats an earlier
+ * one gets that block's output again through copy() instead of another
+ * run of GPG.  tell() returns the offset the next byte written will have,
+ * or -1 if it can not say, and copy() writes out a span already written.
+ * read(), also optional, reads at most the given number of bytes of GPG's
+ * plaintext from a descriptor straight into the sink's own buffer, and
+ * returns the number read, zero at end of file, or -1 with errno set.
+ */
+typedef struct _pinegpg_sink {
+	int     (*write)(void *, const char *, size_t);
+	off_t   (*tell)(void *);
+	int     (*copy)(void *, off_t, size_t);
+	ssize_t (*read)(void *, int, size_t);
+	void    *ctx;
+} pinegpg_sink;
+
+const char *pinegpg_strerror(int);
+int pinegpg_scan(const char *, size_t, pinegpg_block *, int);
+int pinegpg_transform(const pinegpg_config *, const char *, size_t,
+		      const pinegpg_sink *);
+int pinegpg_protect(const pinegpg_config *, pinegpg_how, const char *,
+		    size_t, const pinegpg_sink *, int *);
+int pinegpg_import(const pinegpg_config *, const char *, size_t,
+		   const pinegpg_sink *);
+
+#endif /* LIBPINEGPG_H */
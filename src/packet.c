@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * packet.c - OpenPGP armor and packet parsing.
+ * created 19 Oct 2026
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "packet.h"
+
+/*
+ * Just enough of RFC 4880 (and the v6 packets of RFC 9580) to read the key
+ * IDs out of the session key packets at the front of an encrypted message
+ * and out of the signature packets of a clearsigned one, without running
+ * gpg(1).  Nothing here decrypts or verifies anything.
+ */
+
+#define TAG_PKESK	1
+#define TAG_SIG		2
+#define TAG_SKESK	3
+#define TAG_SED		9
+#define TAG_MARKER	10
+#define TAG_SEIPD	18
+#define TAG_AEAD	20
+
+#define SUB_ISSUER	16
+#define SUB_ISSUER_FPR	33
+
+/**
+ * Map a base64 character to its value.
+ *
+ * @param  c  The character.
+ * @return    Its six bit value, or -1 if it is not a base64 character.
+ */
+static int b64_value(const int c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+	return -1;
+}
+
+/**
+ * Decode the base64 body of an ASCII armored block.  Any armor headers
+ * are skipped, and decoding stops at the checksum or END line.
+ *
+ * @param  p    The first byte after the BEGIN line.
+ * @param  e    One past the end of the block.
+ * @param  len  Set to the number of bytes decoded.
+ * @return      A newly allocated buffer holding the packets, or NULL if the
+ *              armor is malformed or memory ran out.
+ */
+unsigned char *armor_decode(const char *p, const char *e, size_t *len)
+{
+	int v, bits = 0;
+	unsigned long acc = 0;
+	unsigned char *data;
+	const char *nl;
+	size_t n = 0;
+
+	/* Armor headers are "Key: value" lines ended by a blank line. */
+	for (; p < e; p = nl + 1) {
+		nl = memchr(p, '\n', e - p);
+		if (nl == NULL)
+			return NULL;
+		if (p == nl || (*p == '\r' && p + 1 == nl)) {
+			p = nl + 1;
+			break;
+		}
+		if (memchr(p, ':', nl - p) == NULL)
+			break;
+	}
+
+	data = malloc((e - p) / 4 * 3 + 3);
+	if (data == NULL)
+		return NULL;
+
+	for (; p < e; p = nl + 1) {
+		nl = memchr(p, '\n', e - p);
+		if (nl == NULL)
+			nl = e;
+		if (*p == '=' || *p == '-')
+			break;
+
+		for (; p < nl; p++) {
+			v = b64_value((unsigned char) *p);
+			if (v == -1) {
+				if (*p == '=')
+					break;
+				continue;
+			}
+			acc = (acc << 6) | v;
+			bits += 6;
+			if (bits >= 8) {
+				bits -= 8;
+				data[n++] = (acc >> bits) & 0xff;
+			}
+		}
+	}
+
+	*len = n;
+
+	return data;
+}
+
+/**
+ * Read a packet header.
+ *
+ * @param  p    The packet, advanced past the header on return.
+ * @param  e    One past the end of the data.
+ * @param  tag  Set to the packet tag.
+ * @param  len  Set to the length of the packet body.
+ * @return      Zero if the body length is known, one if the packet uses an
+ *              indeterminate or partial length, or -1 if it is malformed.
+ */
+static int packet_header(const unsigned char **p, const unsigned char *e,
+			 int *tag, size_t *len)
+{
+	const unsigned char *q = *p;
+	int c, n;
+
+	if (q >= e || !(*q & 0x80))
+		return -1;
+
+	c = *q++;
+	if (c & 0x40) {
+		*tag = c & 0x3f;
+		if (q >= e)
+			return -1;
+		if (*q < 192) {
+			*len = *q++;
+		} else if (*q < 224) {
+			if (e - q < 2)
+				return -1;
+			*len = ((q[0] - 192) << 8) + q[1] + 192;
+			q += 2;
+		} else if (*q == 255) {
+			if (e - q < 5)
+				return -1;
+			*len = ((size_t) q[1] << 24) | (q[2] << 16) |
+			       (q[3] << 8) | q[4];
+			q += 5;
+		} else {
+			*p = q + 1;
+			return 1;
+		}
+	} else {
+		*tag = (c >> 2) & 0x0f;
+		n = c & 0x03;
+		if (n == 3) {
+			*p = q;
+			return 1;
+		}
+		n = 1 << n;
+		if (e - q < n)
+			return -1;
+		for (*len = 0; n > 0; n--)
+			*len = (*len << 8) | *q++;
+	}
+
+	*p = q;
+
+	return (*len > (size_t) (e - q)) ? -1 : 0;
+}
+
+/**
+ * Collect the recipient key IDs from the session key packets that start an
+ * encrypted message.
+ *
+ * @param  d    The decoded packets.
+ * @param  len  The size of the packets in bytes.
+ * @param  ids  Filled in with the key IDs.  An anonymous recipient's key
+ *              ID is all zeros.
+ * @param  max  The number of entries in ids.
+ * @return      The number of key IDs found, or -1 if this is not an
+ *              encrypted message that can be read this way.
+ */
+int pkesk_keyids(const unsigned char *d, size_t len, pgp_keyid *ids,
+		 int max)
+{
+	const unsigned char *p = d, *e = d + len;
+	int r, tag, n = 0;
+	size_t blen;
+
+	while (p < e) {
+		r = packet_header(&p, e, &tag, &blen);
+		if (r == -1)
+			return -1;
+
+		switch (tag) {
+		case TAG_SED:
+		case TAG_SEIPD:
+		case TAG_AEAD:
+			return n;
+		case TAG_PKESK:
+			if (r != 0 || blen < 1 + KEYID_LEN || p[0] != 3 ||
+			    n == max)
+				return -1;
+			memcpy(ids[n++], p + 1, KEYID_LEN);
+			break;
+		case TAG_SKESK:
+		case TAG_MARKER:
+			if (r != 0)
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+
+		p += blen;
+	}
+
+	return -1;
+}
+
+/**
+ * Read a signature subpacket length.
+ *
+ * @param  p    The subpacket, advanced past the length on return.
+ * @param  e    One past the end of the subpacket area.
+ * @param  len  Set to the length of the subpacket.
+ * @return      Zero on success, or -1 if it is malformed.
+ */
+static int subpacket_length(const unsigned char **p, const unsigned char *e,
+			    size_t *len)
+{
+	const unsigned char *q = *p;
+
+	if (q >= e)
+		return -1;
+
+	if (*q < 192) {
+		*len = *q++;
+	} else if (*q < 255) {
+		if (e - q < 2)
+			return -1;
+		*len = ((q[0] - 192) << 8) + q[1] + 192;
+		q += 2;
+	} else {
+		if (e - q < 5)
+			return -1;
+		*len = ((size_t) q[1] << 24) | (q[2] << 16) | (q[3] << 8) |
+		       q[4];
+		q += 5;
+	}
+
+	*p = q;
+
+	return (*len == 0 || *len > (size_t) (e - q)) ? -1 : 0;
+}
+
+/**
+ * Find the issuer key ID among the subpackets of a signature.
+ *
+ * @param  p   The first subpacket.
+ * @param  e   One past the last subpacket.
+ * @param  id  Filled in with the key ID.
+ * @return     One if it was found, zero if not, or -1 if the subpackets are
+ *             malformed.
+ */
+static int sub_issuer(const unsigned char *p, const unsigned char *e,
+		      unsigned char *id)
+{
+	size_t len;
+
+	while (p < e) {
+		if (subpacket_length(&p, e, &len) == -1)
+			return -1;
+
+		switch (p[0] & 0x7f) {
+		case SUB_ISSUER:
+			if (len != 1 + KEYID_LEN)
+				return -1;
+			memcpy(id, p + 1, KEYID_LEN);
+			return 1;
+		case SUB_ISSUER_FPR:
+			/* A v4 key ID ends its fingerprint, a v6 one starts
+			 * it.
+			 */
+			if (len == 2 + 20 && p[1] == 4) {
+				memcpy(id, p + len - KEYID_LEN, KEYID_LEN);
+				return 1;
+			}
+			if (len == 2 + 32 && p[1] == 6) {
+				memcpy(id, p + 2, KEYID_LEN);
+				return 1;
+			}
+			break;
+		}
+
+		p += len;
+	}
+
+	return 0;
+}
+
+/**
+ * Collect the issuer key IDs of the signature packets of a detached or
+ * clearsigned signature.
+ *
+ * @param  d    The decoded packets.
+ * @param  len  The size of the packets in bytes.
+ * @param  ids  Filled in with the key IDs.
+ * @param  max  The number of entries in ids.
+ * @return      The number of key IDs found, or -1 if any signature could
+ *              not be read.
+ */
+int sig_keyids(const unsigned char *d, size_t len, pgp_keyid *ids, int max)
+{
+	const unsigned char *p = d, *e = d + len, *q, *qe;
+	int i, r, tag, n = 0, wide;
+	size_t blen, slen;
+
+	while (p < e) {
+		if (packet_header(&p, e, &tag, &blen) != 0 || tag != TAG_SIG ||
+		    n == max || blen < 1)
+			return -1;
+
+		q = p;
+		qe = p + blen;
+		p += blen;
+
+		if (q[0] == 3) {
+			if (blen < 7 + KEYID_LEN)
+				return -1;
+			memcpy(ids[n++], q + 7, KEYID_LEN);
+			continue;
+		}
+
+		if (q[0] != 4 && q[0] != 6)
+			return -1;
+
+		/* Hashed subpackets, then unhashed ones where the issuer
+		 * usually is.  RFC 9580 widened both counts to four octets.
+		 */
+		wide = (q[0] == 6) ? 4 : 2;
+		q += 4;
+
+		for (i = 0; i < 2; i++) {
+			if (qe - q < wide)
+				return -1;
+			if (wide == 4)
+				slen = ((size_t) q[0] << 24) | (q[1] << 16) |
+				       (q[2] << 8) | q[3];
+			else
+				slen = (q[0] << 8) | q[1];
+			q += wide;
+			if (slen > (size_t) (qe - q))
+				return -1;
+			r = sub_issuer(q, q + slen, ids[n]);
+			if (r == -1)
+				return -1;
+			if (r == 1)
+				break;
+			q += slen;
+		}
+
+		if (i == 2)
+			return -1;
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Read the hash algorithm of the first signature in decoded packets, as
+ * needed for the micalg parameter of a PGP/MIME signed message.
+ *
+ * @param  d    The decoded packets.
+ * @param  len  The size of the packets in bytes.
+ * @return      The OpenPGP hash algorithm ID, or -1 if there is no
+ *              signature that can be read.
+ */
+int sig_hash_algo(const unsigned char *d, size_t len)
+{
+	int tag;
+	size_t blen;
+
+	if (packet_header(&d, d + len, &tag, &blen) != 0 || tag != TAG_SIG ||
+	    blen < 1)
+		return -1;
+
+	/* Version 3 keeps the hashed material first; later versions put
+	 * the algorithms right after the signature type.
+	 */
+	if (d[0] == 3)
+		return (blen > 16) ? d[16] : -1;
+
+	if (d[0] == 4 || d[0] == 6)
+		return (blen > 3) ? d[3] : -1;
+
+	return -1;
+}
+
+/**
+ * Tell whether decoded packets start with a public key packet, as a
+ * transferable public key must.
+ *
+ * @param  d    The decoded packets.
+ * @param  len  The size of the packets in bytes.
+ * @return      One if they do, or zero if not.
+ */
+int is_public_key(const unsigned char *d, size_t len)
+{
+	int tag;
+	size_t body;
+
+	return packet_header(&d, d + len, &tag, &body) != -1 && tag == 6;
+}
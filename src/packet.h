@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * packet.h - OpenPGP armor and packet parsing.
+ */
+
+#ifndef PACKET_H
+#define PACKET_H 1
+
+#include <stddef.h>
+
+#define KEYID_LEN 8
+
+typedef unsigned char pgp_keyid[KEYID_LEN];
+
+unsigned char *armor_decode(const char *, const char *, size_t *);
+int pkesk_keyids(const unsigned char *, size_t, pgp_keyid *, int);
+int sig_keyids(const unsigned char *, size_t, pgp_keyid *, int);
+int sig_hash_algo(const unsigned char *, size_t);
+int is_public_key(const unsigned char *, size_t);
+
+#endif /* PACKET_H */
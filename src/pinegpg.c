@@ -20,6 +20,7 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -27,19 +28,110 @@
 
 #include "pinegpg.h"
 #include "display.h"
+#include "import.h"
+#include "rekey.h"
 #include "sending.h"
+#include "trustdb.h"
+#include "warm.h"
 #include "utility.h"
 
 #include "config.h"
 
 static const char *program_version = "1.3.1-rc1";
 
+/**
+ * Parse a size given on the command line, with an optional suffix of K, M,
+ * or G if suffixes are allowed.
+ *
+ * @param  str       The string to parse.
+ * @param  suffixes  Non-zero to allow a suffix.
+ * @return           The size, or -1 if the string is not a valid size or
+ *                   does not fit in a long.
+ */
+static long parse_size(const char *str, const int suffixes)
+{
+	long size, unit = 1;
+	char *end;
+
+	if (str == NULL || *str < '0' || *str > '9')
+		return -1;
+
+	errno = 0;
+	size = strtol(str, &end, 10);
+	if (errno == ERANGE)
+		return -1;
+
+	if (suffixes && *end != '\0' && end[1] == '\0') {
+		switch (*end) {
+		case 'G': case 'g': unit = 1024L * 1024 * 1024; end++; break;
+		case 'M': case 'm': unit = 1024L * 1024;        end++; break;
+		case 'K': case 'k': unit = 1024L;               end++; break;
+		}
+	}
+
+	if (*end != '\0' || size < 0 || size > LONG_MAX / unit)
+		return -1;
+
+	return size * unit;
+}
+
+/**
+ * Parse the comma separated list of limits given with -l.
+ *
+ * @param  config  The program configuration.
+ * @param  str     The option argument.
+ * @return         Zero on success, or -1 if the list is invalid.
+ */
+static int parse_limits(program_config *config, char *str)
+{
+	char *value;
+	long *limit;
+	char * const tokens[] = { "block", "message", "cpu", "as", "fsize",
+				  NULL };
+
+	while (*str != '\0') {
+		switch (getsubopt(&str, tokens, &value)) {
+		case 0:  limit = &config->lib.max_block;   break;
+		case 1:  limit = &config->lib.max_message; break;
+		case 2:  limit = &config->lib.max_cpu;     break;
+		case 3:  limit = &config->lib.max_as;      break;
+		case 4:  limit = &config->lib.max_fsize;   break;
+		default: return -1;
+		}
+
+		/* A time limit is in seconds; K, M, and G make no sense. */
+		*limit = parse_size(value, limit != &config->lib.max_cpu);
+		if (*limit < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 static void pr_usage(const char *program_name)
 {
-	printf("Usage: %s -d [-v...] [-r <file>] -i <file>\n"
-	       "       %s -s [-v...] [-r <file>] -i <file> <recipient> "
-	       "[<recipient>...]\n",
-	       program_name, program_name);
+	printf("Usage: %s -d [-v...] [-j <n>] [-l <list>] [-x|-X <trace>] "
+	       "[-r <file>]\n"
+	       "             -i <file>\n"
+	       "       %s -s [-v...] [-j <n>] [-l <list>] [-p <when>] "
+	       "[-x|-X <trace>]\n"
+	       "             [-r <file>] -i <file>\n"
+	       "             <recipient> [<recipient>...]\n"
+	       "       %s -R [-v...] [-j <n>] [-l <list>] [-w <n>] "
+	       "[-r <file>]\n"
+	       "             -i <file|dir> <recipient> [<recipient>...]\n"
+	       "       %s -T [-v...] [-l <list>] [-r <file>]\n"
+	       "       %s -I [-v...] [-j <n>] [-l <list>] [-x|-X <trace>] "
+	       "[-r <file>]\n"
+	       "             -i <file>\n"
+	       "       %s -M [-a] [-v...] [-j <n>] [-l <list>] [-r <file>] "
+	       "<maildir>\n"
+	       "             [<maildir>...]\n"
+	       "       %s -P [-v...] [-j <n>] [-l <list>] [-x|-X <trace>] "
+	       "[-r <file>]\n"
+	       "             -i <file>\n",
+	       program_name, program_name, program_name, program_name,
+	       program_name, program_name, program_name);
 }
 
 static void exit_usage(const char *program_name)
@@ -71,10 +163,26 @@ static void pr_help(void)
 "  -S         Sending filter mode: sign without prompting.\n"
 "  -E         Sending filter mode: encrypt without prompting.\n"
 "  -B         Sending filter mode: sign and encrypt without prompting.\n"
-"  -i <file>  Input/output file.\n"
+"  -P         Sign a whole message as PGP/MIME, leaving its body as it is.\n"
+"  -R         Re-key mode: re-encrypt PGP messages to new recipients.\n"
+"  -T         Check the GPG trust database and record when it was done.\n"
+"  -I         Import filter mode: import all public key blocks at once.\n"
+"  -M         Watch Maildirs and pre-render new messages for -d.\n"
+"  -a         With -M, pre-render encrypted messages too (stores the\n"
+"             decrypted text on disk).\n"
+"  -i <file>  Input/output file, or - to filter stdin to stdout.\n"
 "  -r <file>  Result file for filtering status/errors.\n"
 "  -g <path>  Specify an alternate path to the GPG binary.\n"
+"  -j <n>     Run at most <n> GPG processes at once host-wide.\n"
+"  -l <list>  Limit GPG resources, e.g. block=16M,message=64M,cpu=30,\n"
+"             as=512M,fsize=64M (zero for no limit).\n"
 "  -k <key>   Specify the default signing key to use.\n"
+"  -p <when>  Send already protected messages as they are: never, match\n"
+"             (the default), or any.\n"
+"  -w <n>     Re-key up to <n> files of a directory at once.\n"
+"  -x <file>  Append a trace of each GPG run to <file>.\n"
+"  -X <file>  Like -x, but leave out GPG's messages and arguments that are\n"
+"             not options.\n"
 "  -v         Have GPG be verbose in it's output.\n"
 "  -h         Print program help (this screen) and exit.\n"
 "  -V         Print program version and exit.\n"
@@ -91,21 +199,42 @@ static void exit_help(const char *program_name)
 
 int main(int argc, char *argv[])
 {
-	char opt;
+	char opt, *end, **args;
+	int nr_args;
 	struct rlimit limit;
-	pinegpg_config config;
+	program_config config;
 
 	config.mode = no_mode;
 	config.input_file = NULL;
 	config.result_file = NULL;
-	config.rcpts = NULL;
-	config.nr_rcpts = 0;
-	config.gpg = GPG_PATH;
-	config.default_key = NULL;
-	config.verbose = 0;
+	config.lib.rcpts = NULL;
+	config.lib.nr_rcpts = 0;
+	config.lib.gpg = GPG_PATH;
+	config.lib.default_key = NULL;
+	config.lib.verbose = 0;
+	config.lib.unattended = 0;
+	config.skip = skip_match;
+	config.lib.max_gpg = 0;
+	config.workers = 1;
+	config.lib.max_block = 0;
+	config.lib.max_message = 0;
+	config.lib.max_cpu = 0;
+	config.lib.max_as = 0;
+	config.lib.max_fsize = 0;
+	config.lib.import_options = IMPORT_OPTIONS;
+	config.warm_encrypted = 0;
+	config.maildirs = NULL;
+	config.nr_maildirs = 0;
+	config.lib.trace_file = NULL;
+	config.lib.trace_redact = 0;
+	config.lib.note = note_result;
 
-	while ((opt = getopt(argc, argv, "BdEeg:hi:k:r:Sst:Vv")) != -1) {
+	while ((opt = getopt(argc, argv,
+			     "aBdEeg:hIi:j:k:l:MPp:Rr:SsTt:Vvw:X:x:")) != -1) {
 		switch (opt) {
+		case 'a':	/* warm encrypted messages too */
+			config.warm_encrypted = 1;
+			break;
 		case 'B':	/* sending filter, auto sign and encrypt */
 			config.mode = both_mode;
 			break;
@@ -116,16 +245,48 @@ int main(int argc, char *argv[])
 			config.mode = encrypt_mode;
 			break;
 		case 'g':	/* gpg(1) */
-			config.gpg = optarg;
+			config.lib.gpg = optarg;
 			break;
 		case 'h':	/* help */
 			exit_help(argv[0]);
 			break;
+		case 'I':	/* import filter */
+			config.mode = import_mode;
+			break;
 		case 'i':	/* input/output file */
 			config.input_file = optarg;
 			break;
+		case 'j':	/* host-wide gpg(1) process limit */
+			config.lib.max_gpg = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    config.lib.max_gpg < 1)
+				exit_usage(argv[0]);
+			break;
 		case 'k':	/* default key */
-			config.default_key = optarg;
+			config.lib.default_key = optarg;
+			break;
+		case 'l':	/* gpg(1) resource limits */
+			if (parse_limits(&config, optarg))
+				exit_usage(argv[0]);
+			break;
+		case 'M':	/* Maildir warmer */
+			config.mode = warm_mode;
+			break;
+		case 'P':	/* PGP/MIME sign a whole message */
+			config.mode = mime_sign_mode;
+			break;
+		case 'p':	/* already protected message policy */
+			if (strcmp(optarg, "never") == 0)
+				config.skip = skip_never;
+			else if (strcmp(optarg, "match") == 0)
+				config.skip = skip_match;
+			else if (strcmp(optarg, "any") == 0)
+				config.skip = skip_any;
+			else
+				exit_usage(argv[0]);
+			break;
+		case 'R':	/* re-key filter */
+			config.mode = rekey_mode;
 			break;
 		case 'r':	/* result file */
 			config.result_file = optarg;
@@ -137,32 +298,65 @@ int main(int argc, char *argv[])
 		case 'e':	/* encrypt, deprecated */
 			config.mode = sending_mode;
 			break;
+		case 'T':	/* trust database maintenance */
+			config.mode = trustdb_mode;
+			break;
 		case 't':	/* temporary directory, obsolete */
 			break;
 		case 'V':	/* program version */
 			exit_version();
 			break;
 		case 'v':	/* gpg(1) verbose output */
-			config.verbose++;
+			config.lib.verbose++;
+			break;
+		case 'w':	/* re-key worker processes */
+			config.workers = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' ||
+			    config.workers < 1)
+				exit_usage(argv[0]);
+			break;
+		case 'X':	/* redacted trace of gpg(1) runs */
+		case 'x':	/* trace of gpg(1) runs */
+			config.lib.trace_file = optarg;
+			config.lib.trace_redact = (opt == 'X');
 			break;
 		default:
 			exit_usage(argv[0]);
 		}
 	}
 
-	if (config.input_file == NULL)
+	config.lib.note_ctx = config.result_file;
+
+	if (config.input_file == NULL && config.mode != trustdb_mode &&
+	    config.mode != warm_mode)
 		exit_usage(argv[0]);
 
+	/* An input file of "-" filters stdin to stdout. */
+	config.streaming = (config.input_file != NULL &&
+			    strcmp(config.input_file, "-") == 0);
+
+	/* The warmer takes Maildirs where the other modes take recipients. */
 	if (optind < argc) {
-		config.rcpts = malloc(sizeof (char *) * (argc - optind + 1));
-		if (config.rcpts == NULL)
+		args = malloc(sizeof (char *) * (argc - optind + 1));
+		if (args == NULL)
 			die_x(EXIT_FAILURE, errno, config.result_file,
 			      "Failed to create array for recipient list");
 
-		for (; optind < argc; optind++, config.nr_rcpts++)
-			config.rcpts[config.nr_rcpts] = argv[optind];
+		for (nr_args = 0; optind < argc; optind++, nr_args++)
+			args[nr_args] = argv[optind];
+
+		if (config.mode == warm_mode) {
+			config.maildirs = args;
+			config.nr_maildirs = nr_args;
+		} else {
+			config.lib.rcpts = args;
+			config.lib.nr_rcpts = nr_args;
+		}
 	}
 
+	/* The warmer runs in the background, with nobody to ask. */
+	config.lib.unattended = (config.mode == warm_mode);
+
 	limit.rlim_cur = 0;
 	limit.rlim_max = 0;
 	if (setrlimit(RLIMIT_CORE, &limit))
@@ -171,7 +365,18 @@ int main(int argc, char *argv[])
 
 	if (config.mode == display_mode)
 		display(&config);
-	else if (config.mode >= sending_mode && config.nr_rcpts > 0)
+	else if (config.mode == rekey_mode && config.lib.nr_rcpts > 0)
+		rekey(&config);
+	else if (config.mode == trustdb_mode)
+		trustdb(&config);
+	else if (config.mode == import_mode)
+		import(&config);
+	else if (config.mode == warm_mode && config.nr_maildirs > 0)
+		warm(&config);
+	else if (config.mode >= sending_mode && config.mode <= both_mode &&
+		 config.lib.nr_rcpts > 0)
+		sending(&config);
+	else if (config.mode == mime_sign_mode)
 		sending(&config);
 	else
 		exit_usage(argv[0]);
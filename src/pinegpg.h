@@ -16,29 +16,46 @@
  * created 27 Jul 2004
  */
 
+#include "libpinegpg.h"
+
 #ifndef PINEGPG_H
 #define PINEGPG_H 1
 
 #define BUF_SIZE 4096
+#define OUT_BUF_SIZE 32768
 
 typedef enum _program_mode {
 	no_mode,
 	display_mode,
+	rekey_mode,
+	trustdb_mode,
 	sending_mode,
 	encrypt_mode,
 	sign_mode,
-	both_mode
+	both_mode,
+	import_mode,
+	warm_mode,
+	mime_sign_mode
 } program_mode;
 
-typedef struct _pinegpg_config {
+typedef enum _skip_policy {
+	skip_never,
+	skip_match,
+	skip_any
+} skip_policy;
+
+/* The library's configuration and what only the filters use. */
+typedef struct _program_config {
+	pinegpg_config lib;
 	program_mode mode;
 	char *input_file;
+	int  streaming;
 	char *result_file;
-	char **rcpts;
-	int  nr_rcpts;
-	char *gpg;
-	char *default_key;
-	int  verbose;
-} pinegpg_config;
+	skip_policy skip;
+	int  workers;
+	int  warm_encrypted;
+	char **maildirs;
+	int  nr_maildirs;
+} program_config;
 
 #endif /* PINEGPG_H */
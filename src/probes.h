@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * probes.h - USDT static probes.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H 1
+
+#include "config.h"
+
+/*
+ * With --enable-usdt each probe is a single nop in the instruction stream
+ * that bpftrace(8) or perf(1) can attach to as usdt:pine.gpg:pinegpg:NAME.
+ * Otherwise the probes, their arguments, and the clock reads that feed
+ * them compile away to nothing.
+ */
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+#include <sys/time.h>
+
+#define PROBE1(name, a)             DTRACE_PROBE1(pinegpg, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(pinegpg, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(pinegpg, name, a, b, c)
+
+#define PROBE_CLOCK(tv)             gettimeofday(&(tv), NULL)
+#define PROBE_USECS(start, end)     ((long) ((end).tv_sec - (start).tv_sec) \
+				     * 1000000L + ((end).tv_usec -          \
+						   (start).tv_usec))
+
+#else
+
+#define PROBE1(name, a)             do { } while (0)
+#define PROBE2(name, a, b)          do { } while (0)
+#define PROBE3(name, a, b, c)       do { } while (0)
+
+#define PROBE_CLOCK(tv)             ((void) &(tv))
+
+#endif /* ENABLE_USDT */
+
+#endif /* PROBES_H */
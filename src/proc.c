@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * proc.c - Child process helpers that never exit the caller.
+ * created 19 Oct 2026
+ */
+
+/* For pipe2(2) where the C library has it, and wait4(2). */
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "pinegpg.h"
+#include "probes.h"
+#include "proc.h"
+
+#include "config.h"
+
+/*
+ * Everything here is shared by libpinegpg and the filters, so none of it
+ * may call die_x().  Errors are returned to the caller, and a child that
+ * fails before exec notes why and exits with 127.
+ */
+
+/**
+ * Give an informational message to the configured note function, if any.
+ * Unlike die_x() this does not terminate the program, and without a note
+ * function the message is dropped so as not to interrupt the user.
+ *
+ * @param  config  The library configuration.
+ * @param  format  A printf(3)-style format string.
+ * @param  ...     A variable number of arguments for the format string.
+ * @return         Nothing.
+ */
+void note_x(const pinegpg_config *config, const char *format, ...)
+{
+	char msg[256];
+	va_list va;
+
+	if (config->note == NULL)
+		return;
+
+	va_start(va, format);
+	vsnprintf(msg, sizeof (msg), format, va);
+	va_end(va);
+
+	config->note(config->note_ctx, msg);
+}
+
+/**
+ * Apply the configured resource limits to the current process.  This is
+ * called in a GPG child just before exec so that a hostile message can not
+ * make GPG run away with the CPU, memory, or disk.
+ *
+ * @param  config  The program configuration.
+ * @return         Zero on success, or -1 with errno set, in which case the
+ *                 failure has been noted.
+ */
+int limit_gpg(const pinegpg_config *config)
+{
+	int i;
+	struct rlimit limit;
+	const struct {
+		int  resource;
+		long value;
+		const char *name;
+	} limits[] = {
+		{ RLIMIT_CPU,   config->max_cpu,   "CPU time"      },
+		{ RLIMIT_AS,    config->max_as,    "address space" },
+		{ RLIMIT_FSIZE, config->max_fsize, "file size"     }
+	};
+
+	for (i = 0; i < (int) (sizeof (limits) / sizeof (limits[0])); i++) {
+		if (limits[i].value <= 0)
+			continue;
+
+		limit.rlim_cur = limits[i].value;
+		limit.rlim_max = limits[i].value;
+		if (setrlimit(limits[i].resource, &limit)) {
+			note_x(config, "Failed to limit GPG %s: %s",
+			       limits[i].name, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Create a pipe whose ends are closed on exec, so that a GPG child only
+ * keeps the ends it is given with dup2(2) and not those of other pipes
+ * open at the time.
+ *
+ * @param  fds  Set to the read and write ends.
+ * @return      Zero on success, or -1 with errno set.
+ */
+int pipe_cloexec(int fds[2])
+{
+#ifdef HAVE_PIPE2
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) == -1)
+		return -1;
+
+	if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	return 0;
+#endif
+}
+
+/**
+ * Fork a feeder sub-process that writes a buffer to the write end of a pipe
+ * and exits.  The write end is closed in the parent.
+ *
+ * @param  data  The data to write.
+ * @param  len   The size of the data in bytes.
+ * @param  pin   The pipe to write to.
+ * @return       The process ID of the feeder, or -1 with errno set.
+ */
+pid_t start_feeder(const char *data, size_t len, int pin[2])
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *) data;
+	iov.iov_len = len;
+
+	return start_feeder_iov(&iov, 1, pin);
+}
+
+/**
+ * Fork a feeder sub-process that writes several spans of data, in order,
+ * to the write end of a pipe and exits, so that GPG can be given data that
+ * is not contiguous in memory without copying it together first.  The
+ * write end is closed in the parent.  The feeder holds a copy of every
+ * descriptor open at the time, so other pipes to the same GPG should be
+ * created after it has been started.
+ *
+ * @param  iov  The spans to write; their iov_len members are used up.
+ * @param  nr   The number of spans.
+ * @param  pin  The pipe to write to.
+ * @return      The process ID of the feeder, or -1 with errno set.
+ */
+pid_t start_feeder_iov(struct iovec *iov, int nr, int pin[2])
+{
+	pid_t pid;
+	ssize_t bytes;
+	size_t total;
+
+	pid = fork();
+	if (pid == -1)
+		return -1;
+
+	if (pid == 0) {
+		close(pin[0]);
+
+		total = 0;
+		while (nr > 0) {
+			if (iov->iov_len == 0) {
+				iov++;
+				nr--;
+				continue;
+			}
+			bytes = writev(pin[1], iov, nr);
+			if (bytes == -1) {
+				if (errno == EINTR)
+					continue;
+				_exit(127);
+			}
+			total += bytes;
+			for (; nr > 0 && (size_t) bytes >= iov->iov_len; nr--)
+				bytes -= (iov++)->iov_len;
+			if (nr > 0) {
+				iov->iov_base = (char *) iov->iov_base + bytes;
+				iov->iov_len -= bytes;
+			}
+		}
+
+		close(pin[1]);
+
+		PROBE1(feeder__done, (long) total);
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(pin[1]);
+
+	return pid;
+}
+
+/**
+ * Wait for a child process to exit.
+ *
+ * @param  pid     The process ID of the child.
+ * @param  status  Set to its wait status.
+ * @param  ru      If not NULL, set to the resources the child used.
+ * @return         Zero on success, or -1 with errno set.
+ */
+int wait_child(pid_t pid, int *status, struct rusage *ru)
+{
+	while (wait4(pid, status, 0, ru) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * proc.h - Child process helpers that never exit the caller.
+ */
+
+#include "pinegpg.h"
+
+#ifndef PROC_H
+#define PROC_H 1
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+void  note_x(const pinegpg_config *, const char *, ...);
+int   limit_gpg(const pinegpg_config *);
+int   pipe_cloexec(int [2]);
+pid_t start_feeder(const char *, size_t, int [2]);
+pid_t start_feeder_iov(struct iovec *, int, int [2]);
+int   wait_child(pid_t, int *, struct rusage *);
+
+#endif /* PROC_H */
@@ -0,0 +1,660 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * rekey.c - Re-key filter.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "packet.h"
+#include "pinegpg.h"
+#include "proc.h"
+#include "scan.h"
+#include "slots.h"
+#include "utility.h"
+
+/*
+ * The decrypting GPG only removes the encryption (--unwrap), and the
+ * encrypting one wraps what is left as it is (--no-literal), so a message
+ * that was signed and encrypted is still signed once re-keyed.  The
+ * decrypting GPG's status lines are read on descriptor 3 to tell whether
+ * the decryption itself worked.
+ */
+#define STATUS_FD "3"
+
+#define DEC_OKAY   0x01
+#define DEC_FAILED 0x02
+
+/**
+ * Build the argument lists for the decrypting and encrypting GPG processes.
+ *
+ * @param  config    The program configuration.
+ * @param  dec_args  Set to the argument list for decryption.
+ * @param  enc_args  Set to the argument list for encryption.
+ * @return           Nothing.
+ */
+static void build_args(const program_config *config, char ***dec_args,
+		       char ***enc_args)
+{
+	int i, d = 0, n = 0;
+	char **dec, **enc, *gpg;
+	const char *p;
+
+	dec = malloc(sizeof (char *) * 12);
+	enc = malloc(sizeof (char *) * (16 + config->lib.nr_rcpts * 2));
+	if (dec == NULL || enc == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to create array for GPG arguments list");
+
+	p = strrchr(config->lib.gpg, '/');
+	if (p == NULL)
+		p = config->lib.gpg;
+	else
+		p++;
+
+	gpg = strdup(p);
+	if (gpg == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to allocate memory for GPG process name");
+
+	dec[d++] = enc[n++] = gpg;
+	dec[d++] = enc[n++] = "--batch";
+	dec[d++] = enc[n++] = "--no-auto-check-trustdb";
+
+	if (config->lib.verbose > 0)
+		dec[d++] = enc[n++] = "--verbose";
+	else
+		dec[d++] = enc[n++] = "--quiet";
+
+	if (config->lib.verbose > 1)
+		dec[d++] = enc[n++] = "--verbose";
+
+	dec[d++] = "--status-fd";
+	dec[d++] = STATUS_FD;
+	dec[d++] = "--unwrap";
+	dec[d++] = "--decrypt";
+	dec[d++] = "-";
+	dec[d++] = NULL;
+
+	enc[n++] = "--no-literal";
+	enc[n++] = "--compress-algo";
+	enc[n++] = "none";
+	enc[n++] = "--armor";
+	enc[n++] = "--output";
+	enc[n++] = "-";
+	enc[n++] = "--encrypt";
+	for (i = 0; i < config->lib.nr_rcpts; i++) {
+		enc[n++] = "--recipient";
+		enc[n++] = config->lib.rcpts[i];
+	}
+	enc[n++] = NULL;
+
+	*dec_args = dec;
+	*enc_args = enc;
+}
+
+/**
+ * Exec GPG in a child process with the given descriptors as its stdin and
+ * stdout.  Its stderr is left as ours, and every pipe end it is not given
+ * is closed on exec.
+ *
+ * @param  config  The program configuration.
+ * @param  args    A list of arguments to be passed to gpg(1).
+ * @param  in      The descriptor for GPG's stdin.
+ * @param  out     The descriptor for GPG's stdout.
+ * @param  status  The descriptor for GPG's status lines, or -1.
+ * @return         The process ID of GPG.
+ */
+static pid_t spawn_gpg(const program_config *config, char * const *args,
+		       const int in, const int out, const int status)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to create fork for GPG");
+
+	if (pid == 0) {
+		if (dup2(in, 0) == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to reassign GPG stdin to pipe");
+
+		if (dup2(out, 1) == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to reassign GPG stdout to pipe");
+
+		/* dup2() leaves close-on-exec set on a descriptor that is
+		 * already in place.
+		 */
+		if (status != -1 && (status == atoi(STATUS_FD) ?
+				     fcntl(status, F_SETFD, 0) :
+				     dup2(status, atoi(STATUS_FD))) == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to reassign GPG status output to pipe");
+
+		if (limit_gpg(&config->lib) == -1)
+			_exit(127);
+
+		execv(config->lib.gpg, args);
+
+		die_x(127, errno, config->result_file, "Failed to execv(%s)",
+		      config->lib.gpg);
+	}
+
+	return pid;
+}
+
+/**
+ * Note what the decrypting GPG's complete status lines say.
+ *
+ * @param  buf    The status output read so far.
+ * @param  len    Its size in bytes.
+ * @param  flags  DEC_OKAY and DEC_FAILED are set here.
+ * @return        The number of bytes used; the rest is a partial line.
+ */
+static size_t dec_status(const char *buf, size_t len, int *flags)
+{
+	const char *p = buf, *q, *e = buf + len;
+
+	static const char ok[]   = "[GNUPG:] DECRYPTION_OKAY",
+			  fail[] = "[GNUPG:] DECRYPTION_FAILED";
+
+	for (; (q = memchr(p, '\n', e - p)) != NULL; p = q + 1) {
+		if ((size_t) (q - p) >= sizeof (ok) - 1 &&
+		    memcmp(p, ok, sizeof (ok) - 1) == 0)
+			*flags |= DEC_OKAY;
+		if ((size_t) (q - p) >= sizeof (fail) - 1 &&
+		    memcmp(p, fail, sizeof (fail) - 1) == 0)
+			*flags |= DEC_FAILED;
+	}
+
+	return p - buf;
+}
+
+/**
+ * Re-encrypt one PGP message by piping GPG's decrypted output straight into
+ * a second GPG that encrypts it for the new recipients.  The plaintext only
+ * ever exists in the pipe between the two.  Both GPG processes together
+ * take one host-wide slot, since taking two one after the other could
+ * leave every filter holding one and waiting for another.
+ *
+ * @param  config    The program configuration.
+ * @param  path      The path of the file holding the message (for errors).
+ * @param  blk       The PGP message block.
+ * @param  dec_args  The argument list for decryption.
+ * @param  enc_args  The argument list for encryption.
+ * @param  ob        The buffer to append the new PGP message to.
+ * @return           Nothing.
+ */
+static void rekey_block(const program_config *config, const char *path,
+			const pinegpg_block *blk, char * const *dec_args,
+			char * const *enc_args, outbuf *ob)
+{
+	int i, s, slot, flags = 0;
+	int pin[2], pmid[2], pout[2], pstat[2];
+	char status[BUF_SIZE];
+	size_t status_len = 0, used;
+	pid_t pid[3];
+	ssize_t bytes;
+	struct pollfd fds[2];
+
+	static const char *what[] = { "Feeder sub-process",
+				      "GPG decrypt process",
+				      "GPG encrypt process" };
+
+	if (slot_acquire(&config->lib, &slot) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to take a GPG slot");
+
+	if (pipe_cloexec(pin) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to create pipes for GPG");
+
+	pid[0] = spawn_feeder(blk->begin, blk->end - blk->begin, pin,
+			      config->result_file);
+
+	/* Made after the fork so that the feeder holds no write end of them. */
+	if (pipe_cloexec(pmid) == -1 || pipe_cloexec(pout) == -1 ||
+	    pipe_cloexec(pstat) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to create pipes for GPG");
+
+	pid[1] = spawn_gpg(config, dec_args, pin[0], pmid[1], pstat[1]);
+
+	close(pin[0]);
+	close(pmid[1]);
+	close(pstat[1]);
+
+	pid[2] = spawn_gpg(config, enc_args, pmid[0], pout[1], -1);
+
+	close(pmid[0]);
+	close(pout[1]);
+
+	fds[0].fd = pout[0];
+	fds[1].fd = pstat[0];
+	fds[0].events = fds[1].events = POLLIN;
+
+	while (fds[0].fd != -1 || fds[1].fd != -1) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to wait for GPG output");
+		}
+
+		if (fds[0].revents) {
+			bytes = out_read(ob, fds[0].fd, (size_t) -1);
+			if (bytes == -1)
+				die_x(EXIT_FAILURE, errno, config->result_file,
+				      "GPG stdout read error");
+			if (bytes == 0) {
+				close(fds[0].fd);
+				fds[0].fd = -1;
+			}
+		}
+
+		if (fds[1].revents) {
+			/* A line too long to hold is dropped. */
+			if (status_len == sizeof (status))
+				status_len = 0;
+			bytes = read(fds[1].fd, status + status_len,
+				     sizeof (status) - status_len);
+			if (bytes == -1 && errno == EINTR)
+				continue;
+			if (bytes <= 0) {
+				close(fds[1].fd);
+				fds[1].fd = -1;
+				continue;
+			}
+			status_len += bytes;
+			used = dec_status(status, status_len, &flags);
+			memmove(status, status + used, status_len - used);
+			status_len -= used;
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		do {
+			while (waitpid(pid[i], &s, 0) == -1) {
+				if (errno == EINTR)
+					continue;
+				else
+					die_x(EXIT_FAILURE, errno,
+					      config->result_file,
+					      "Failed to reap child process %d",
+					      pid[i]);
+			}
+		} while (!WIFEXITED(s) && !WIFSIGNALED(s));
+
+		if (WIFSIGNALED(s) && WTERMSIG(s))
+			die_x(EXIT_FAILURE, 0, config->result_file,
+			      "%s: %s terminated by signal %d", path, what[i],
+			      WTERMSIG(s));
+
+		/* Exit status 1 only means a signature could not be checked,
+		 * which does not matter as long as the decryption worked.
+		 */
+		if (i == 1 && WEXITSTATUS(s) == 1 && (flags & DEC_OKAY) &&
+		    !(flags & DEC_FAILED))
+			continue;
+
+		if (WEXITSTATUS(s) > 0)
+			die_x(EXIT_FAILURE, 0, config->result_file,
+			      "%s: %s exited with status %d", path, what[i],
+			      WEXITSTATUS(s));
+	}
+
+	if (!(flags & DEC_OKAY) || (flags & DEC_FAILED))
+		die_x(EXIT_FAILURE, 0, config->result_file,
+		      "%s: GPG did not decrypt a PGP message", path);
+
+	slot_release(slot);
+}
+
+/**
+ * Tell whether a PGP message block is encrypted; a message that is only
+ * signed has nothing to re-key.
+ *
+ * @param  blk  The PGP message block.
+ * @return      One if it is, or zero if not.
+ */
+static int is_encrypted(const pinegpg_block *blk)
+{
+	int n;
+	const char *p;
+	unsigned char *data;
+	size_t len;
+	pgp_keyid *ids;
+
+	p = memchr(blk->begin, '\n', blk->end - blk->begin) + 1;
+
+	data = armor_decode(p, blk->end, &len);
+	if (data == NULL)
+		return 0;
+
+	/* No session key packet is shorter than its key ID. */
+	ids = malloc(sizeof (pgp_keyid) * (len / KEYID_LEN + 1));
+	if (ids == NULL) {
+		free(data);
+		return 0;
+	}
+
+	n = pkesk_keyids(data, len, ids, len / KEYID_LEN + 1);
+	free(ids);
+	free(data);
+
+	return n != -1;
+}
+
+/**
+ * Write all of a buffer to a file descriptor.
+ *
+ * @param  fd    The file descriptor.
+ * @param  data  The data to write.
+ * @param  len   Its size in bytes.
+ * @return       Zero on success, or -1 with errno set on error.
+ */
+static int write_span(const int fd, const char *data, size_t len)
+{
+	ssize_t bytes;
+
+	while (len > 0) {
+		bytes = write(fd, data, len);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += bytes;
+		len  -= bytes;
+	}
+
+	return 0;
+}
+
+/**
+ * Replace a file with new contents: they are written to a temporary file
+ * in the same directory, synced, and renamed over the original, so a
+ * crash leaves either the old file or the new one.  The temporary name
+ * starts with a dot so that directory workers pass it by.
+ *
+ * @param  config  The program configuration.
+ * @param  path    The path of the file.
+ * @param  mode    The permissions to give the new file.
+ * @param  head    The unchanged start of the file.
+ * @param  len     Its size in bytes.
+ * @param  ob      The rest of the new contents.
+ * @return         Nothing.
+ */
+static void replace_file(const program_config *config, const char *path,
+			 const mode_t mode, const char *head, size_t len,
+			 const outbuf *ob)
+{
+	int f, err;
+	char *dir_copy, *base_copy, *tmp;
+	const char *what;
+	size_t tmp_len;
+
+	dir_copy = strdup(path);
+	base_copy = strdup(path);
+	tmp_len = strlen(path) + 32;
+	tmp = malloc(tmp_len);
+	if (dir_copy == NULL || base_copy == NULL || tmp == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to allocate memory for file path");
+
+	snprintf(tmp, tmp_len, "%s/.%s.rekey.%ld", dirname(dir_copy),
+		 basename(base_copy), (long) getpid());
+
+	f = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (f == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to create %s", tmp);
+
+	if (fchmod(f, mode) == -1)
+		what = "Failed to set permissions on %s";
+	else if (write_span(f, head, len) == -1 ||
+		 write_span(f, ob->buf, ob->len) == -1)
+		what = "Failed to write %s";
+	else if (fsync(f) == -1)
+		what = "Failed to sync %s";
+	else if (close(f) == -1) {
+		f = -1;
+		what = "Failed to write %s";
+	} else if (rename(tmp, path) == -1) {
+		f = -1;
+		what = "Failed to rename %s into place";
+	} else
+		what = NULL;
+
+	if (what != NULL) {
+		err = errno;
+		if (f != -1)
+			close(f);
+		unlink(tmp);
+		die_x(EXIT_FAILURE, err, config->result_file, what, tmp);
+	}
+
+	free(tmp);
+	free(base_copy);
+	free(dir_copy);
+}
+
+/**
+ * Re-encrypt every PGP message in a file for the configured recipients.
+ * Nothing is written until every message has been re-encrypted, and then
+ * the file is replaced as a whole.
+ *
+ * @param  config    The program configuration.
+ * @param  path      The path of the file.
+ * @param  dec_args  The argument list for decryption.
+ * @param  enc_args  The argument list for encryption.
+ * @return           The number of PGP messages re-encrypted.
+ */
+static int rekey_file(const program_config *config, const char *path,
+		      char * const *dec_args, char * const *enc_args)
+{
+	int f, nr_blocks = 0;
+	char *input;
+	const char *e, *p, *q, *first = NULL;
+	ssize_t input_size;
+	struct stat sbuf;
+	pinegpg_block blk;
+	outbuf ob;
+
+	f = open(path, O_RDONLY);
+	if (f == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to open %s for reading", path);
+
+	if (fstat(f, &sbuf) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to get size of %s", path);
+
+	input_size = sbuf.st_size;
+	if (input_size == 0) {
+		close(f);
+		return 0;
+	}
+
+	input = read_input(f, input_size, config->result_file);
+	e = input + input_size;
+
+	/* Gather the new file contents in memory so that a failure part way
+	 * through leaves the file as it was.
+	 */
+	out_init(&ob, -1, config->result_file);
+
+	for (p = q = input; find_block(input, q, e, PGP_FILTERED, &blk);
+	     q = blk.end) {
+		if (blk.type != PINEGPG_ARMOR_MESSAGE || !is_encrypted(&blk))
+			continue;
+
+		if (first == NULL)
+			first = p = blk.begin;
+
+		out_write(&ob, p, blk.begin - p);
+		rekey_block(config, path, &blk, dec_args, enc_args, &ob);
+		p = blk.end;
+		nr_blocks++;
+	}
+
+	if (first == NULL) {
+		out_free(&ob);
+		free(input);
+		close(f);
+		return 0;
+	}
+
+	out_write(&ob, p, e - p);
+	replace_file(config, path, sbuf.st_mode & 07777, input, first - input,
+		     &ob);
+
+	ob.len = 0;
+	out_free(&ob);
+	free(input);
+	close(f);
+
+	return nr_blocks;
+}
+
+/**
+ * Wait for any one re-key worker to finish.
+ *
+ * @param  config  The program configuration.
+ * @return         Zero if the worker succeeded, or one if it failed.
+ */
+static int reap_worker(const program_config *config)
+{
+	int s;
+
+	while (wait(&s) == -1) {
+		if (errno == EINTR)
+			continue;
+		else
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to reap re-key worker");
+	}
+
+	return !(WIFEXITED(s) && WEXITSTATUS(s) == 0);
+}
+
+/**
+ * Re-key filter for re-encrypting archived PGP messages to a new list of
+ * recipients without ever writing the plaintext to disk.  The input may be
+ * a single file or a directory, whose regular files are then processed by
+ * a pool of worker processes.
+ *
+ * @param  config  The program configuration.
+ * @return         Nothing.
+ */
+void rekey(const program_config *config)
+{
+	int n, running = 0, nr_files = 0, nr_failed = 0;
+	char **dec_args, **enc_args, *path;
+	size_t path_len;
+	pid_t pid;
+	DIR *dir;
+	struct dirent *de;
+	struct stat sbuf;
+
+	const char *result_ok   = "Re-key filter re-encrypted %d PGP "
+				  "message(s).",
+		   *result_dir  = "Re-key filter processed %d file(s).",
+		   *result_fail = "Re-key filter failed on %d of %d file(s).";
+
+	if (config->streaming)
+		die_x(EXIT_FAILURE, 0, config->result_file,
+		      "Re-key filter needs a file or directory to work in");
+
+	build_args(config, &dec_args, &enc_args);
+
+	if (stat(config->input_file, &sbuf) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to stat input %s", config->input_file);
+
+	if (!S_ISDIR(sbuf.st_mode)) {
+		n = rekey_file(config, config->input_file, dec_args, enc_args);
+		die_x(EXIT_SUCCESS, 0, config->result_file, result_ok, n);
+	}
+
+	dir = opendir(config->input_file);
+	if (dir == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to open directory %s", config->input_file);
+
+	path_len = strlen(config->input_file) + NAME_MAX + 2;
+	path = malloc(path_len);
+	if (path == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to allocate memory for file path");
+
+	fflush(stdout);
+
+	while ((de = readdir(dir)) != NULL) {
+		snprintf(path, path_len, "%s/%s", config->input_file,
+			 de->d_name);
+		if (de->d_name[0] == '.' || stat(path, &sbuf) == -1 ||
+		    !S_ISREG(sbuf.st_mode))
+			continue;
+
+		if (running == config->workers) {
+			nr_failed += reap_worker(config);
+			running--;
+		}
+
+		pid = fork();
+		if (pid == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to create fork for re-key worker");
+
+		if (pid == 0) {
+			/* Keep a failing worker from waiting on the user. */
+			n = open("/dev/null", O_RDONLY);
+			if (n != -1)
+				dup2(n, 0);
+
+			rekey_file(config, path, dec_args, enc_args);
+			exit(EXIT_SUCCESS);
+		}
+
+		running++;
+		nr_files++;
+	}
+
+	closedir(dir);
+
+	for (; running > 0; running--)
+		nr_failed += reap_worker(config);
+
+	if (nr_failed)
+		die_x(EXIT_FAILURE, 0, config->result_file, result_fail,
+		      nr_failed, nr_files);
+
+	die_x(EXIT_SUCCESS, 0, config->result_file, result_dir, nr_files);
+}
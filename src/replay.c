@@ -0,0 +1,850 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * replay.c - Print and replay traces of GPG runs.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pinegpg.h"
+#include "scan.h"
+#include "trace.h"
+
+/*
+ * A replay runs pine.gpg once for each call in the trace, on a message made
+ * up to have the same size and PGP blocks, with this program standing in
+ * for GPG.  The stand-in drains its input, then writes as many bytes to
+ * stdout and stderr, as late, as the traced GPG did, and exits the same
+ * way.  What the replay measures is therefore the filter itself, so a
+ * change to it can be checked against traffic from real users without
+ * their keys or their mail.
+ */
+
+#define PLAN_ENV "PINEGPG_REPLAY_PLAN"
+#define SEQ_ENV  "PINEGPG_REPLAY_SEQ"
+
+typedef struct _rp_block {
+	unsigned long offset;
+	unsigned long len;
+	unsigned long type;
+	unsigned long copy;		/* offset of an earlier copy plus one */
+} rp_block;
+
+typedef struct _rp_event {
+	unsigned long stream;
+	unsigned long usec;
+	unsigned long bytes;
+} rp_event;
+
+typedef struct _rp_run {
+	int           reaped;
+	unsigned long status;
+	unsigned long elapsed;
+	rp_event      *events;
+	int           nr_events;
+} rp_run;
+
+typedef struct _rp_call {
+	unsigned long pid;
+	unsigned long kind;
+	unsigned long how;
+	unsigned long len;
+	unsigned long nr_rcpts;
+	unsigned long max_block;
+	unsigned long max_message;
+	rp_block      *blocks;
+	int           nr_blocks;
+	rp_run        *runs;
+	int           nr_runs;
+} rp_call;
+
+static const char *program_name;
+
+static void fatal(int errnum, const char *format, ...)
+{
+	va_list va;
+
+	fprintf(stderr, "%s: ", program_name);
+
+	va_start(va, format);
+	vfprintf(stderr, format, va);
+	va_end(va);
+
+	if (errnum != 0)
+		fprintf(stderr, ": %s", strerror(errnum));
+
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Make room for one more entry at the end of a table, zeroed.  A table is
+ * doubled when it is full: it holds eight entries to start with, and then
+ * the power of two at or above its count, so its size need not be kept.
+ *
+ * @param  p     The table, or NULL.
+ * @param  nr    The number of entries in it.
+ * @param  size  The size of an entry.
+ * @return       The table, perhaps moved.
+ */
+static void *grow(void *p, int nr, size_t size)
+{
+	if (nr == 0 || (nr >= 8 && (nr & (nr - 1)) == 0)) {
+		p = realloc(p, (nr ? 2 * nr : 8) * size);
+		if (p == NULL)
+			fatal(errno, "Failed to grow trace tables");
+	}
+
+	memset((char *) p + nr * size, 0, size);
+
+	return p;
+}
+
+/**
+ * Read a varint from a record.
+ *
+ * @param  p  The read position, advanced past the number.
+ * @param  e  One past the end of the record.
+ * @return    The number.
+ */
+static unsigned long get_num(const unsigned char **p, const unsigned char *e)
+{
+	unsigned long v = 0;
+	int shift = 0;
+
+	while (*p < e && shift < (int) (sizeof (v) * CHAR_BIT)) {
+		v |= (unsigned long) (**p & 0x7f) << shift;
+		if ((*(*p)++ & 0x80) == 0)
+			return v;
+		shift += 7;
+	}
+
+	fatal(0, "Trace is corrupt");
+	return 0;
+}
+
+/**
+ * Read a string from a record.
+ *
+ * @param  p    The read position, advanced past the string.
+ * @param  e    One past the end of the record.
+ * @param  len  Set to the length of the string.
+ * @return      The string, which is not NUL terminated.
+ */
+static const char *get_str(const unsigned char **p, const unsigned char *e,
+			   unsigned long *len)
+{
+	const char *s;
+
+	*len = get_num(p, e);
+	if (*len > (unsigned long) (e - *p))
+		fatal(0, "Trace is corrupt");
+
+	s = (const char *) *p;
+	*p += *len;
+
+	return s;
+}
+
+static const char *mode_name(unsigned long kind, unsigned long how)
+{
+	if (kind == TRACE_TRANSFORM)
+		return "display";
+	if (kind == TRACE_IMPORT)
+		return "import";
+
+	switch (how) {
+	case PINEGPG_SIGN:         return "sign";
+	case PINEGPG_ENCRYPT:      return "encrypt";
+	case PINEGPG_SIGN_ENCRYPT: return "sign+encrypt";
+	case PINEGPG_MIME_SIGN:    return "PGP/MIME sign";
+	}
+
+	return "unknown";
+}
+
+static const char *kind_name(unsigned long kind)
+{
+	switch (kind) {
+	case TRACE_TRANSFORM: return "transform";
+	case TRACE_PROTECT:   return "protect";
+	case TRACE_IMPORT:    return "import";
+	}
+
+	return "unknown";
+}
+
+static const char *type_name(unsigned long type)
+{
+	switch (type) {
+	case PINEGPG_ARMOR_MESSAGE:        return "message";
+	case PINEGPG_ARMOR_SIGNED_MESSAGE: return "signed";
+	case PINEGPG_ARMOR_PUBLIC_KEY:     return "public-key";
+	case PINEGPG_ARMOR_PRIVATE_KEY:    return "private-key";
+	case PINEGPG_ARMOR_SIGNATURE:      return "signature";
+	case PINEGPG_ARMOR_MESSAGE_PART:   return "message-part";
+	}
+
+	return "unknown";
+}
+
+static void pr_status(int s)
+{
+	if (WIFSIGNALED(s))
+		printf("signal %d", WTERMSIG(s));
+	else
+		printf("exit %d", WEXITSTATUS(s));
+}
+
+static void pr_text(const char *s, unsigned long len)
+{
+	for (; len > 0; s++, len--) {
+		if (*s == '\n')
+			printf("\\n");
+		else if (*s < ' ' || *s > '~')
+			printf("\\x%02x", (unsigned char) *s);
+		else
+			putchar(*s);
+	}
+}
+
+static rp_call *find_call(rp_call *calls, int nr_calls, unsigned long pid)
+{
+	while (nr_calls-- > 0) {
+		if (calls[nr_calls].pid == pid)
+			return &calls[nr_calls];
+	}
+
+	fatal(0, "Trace has a record of process %lu before its call", pid);
+	return NULL;
+}
+
+/**
+ * Read a trace, printing its records if asked to.
+ *
+ * @param  file      The trace file.
+ * @param  print     Print each record as it is read.
+ * @param  nr_calls  Set to the number of calls read.
+ * @return           The calls.
+ */
+static rp_call *read_trace(const char *file, int print, int *nr_calls)
+{
+	int f, type;
+	unsigned long i, len, pid, argc, sec, usec;
+	unsigned char *data;
+	const unsigned char *p, *e, *end;
+	const char *s;
+	struct stat sbuf;
+	ssize_t bytes;
+	rp_call *calls = NULL, *call;
+	rp_block *blk;
+	rp_run *run;
+	rp_event *ev;
+
+	*nr_calls = 0;
+
+	f = open(file, O_RDONLY);
+	if (f == -1 || fstat(f, &sbuf) == -1)
+		fatal(errno, "Failed to open %s", file);
+
+	data = malloc(sbuf.st_size + 1);
+	if (data == NULL)
+		fatal(errno, "Failed to read %s", file);
+
+	for (len = 0; len < (unsigned long) sbuf.st_size; len += bytes) {
+		bytes = read(f, data + len, sbuf.st_size - len);
+		if (bytes == -1 && errno == EINTR)
+			bytes = 0;
+		else if (bytes <= 0)
+			fatal(errno, "Failed to read %s", file);
+	}
+	close(f);
+
+	p = data;
+	end = data + len;
+
+	while (p < end) {
+		type = *p++;
+		len = get_num(&p, end);
+		if (len > (unsigned long) (end - p))
+			fatal(0, "Trace is corrupt");
+		e = p + len;
+
+		pid = get_num(&p, e);
+
+		switch (type) {
+		case TRACE_CALL:
+			if (get_num(&p, e) != TRACE_VERSION)
+				fatal(0, "Trace version is not supported");
+
+			calls = grow(calls, *nr_calls, sizeof (rp_call));
+			call = &calls[(*nr_calls)++];
+			call->pid = pid;
+			sec = get_num(&p, e);
+			usec = get_num(&p, e);
+			call->kind = get_num(&p, e);
+			call->how = get_num(&p, e);
+			call->len = get_num(&p, e);
+			call->nr_rcpts = get_num(&p, e);
+			call->max_block = get_num(&p, e);
+			call->max_message = get_num(&p, e);
+
+			if (print)
+				printf("C %lu %lu.%06lu %s %s len=%lu rcpts=%lu "
+				       "block=%lu message=%lu\n", pid, sec, usec,
+				       kind_name(call->kind),
+				       mode_name(call->kind, call->how),
+				       call->len, call->nr_rcpts,
+				       call->max_block, call->max_message);
+			break;
+		case TRACE_BLOCK:
+			call = find_call(calls, *nr_calls, pid);
+			call->blocks = grow(call->blocks, call->nr_blocks,
+					    sizeof (rp_block));
+			blk = &call->blocks[call->nr_blocks++];
+			blk->offset = get_num(&p, e);
+			blk->len = get_num(&p, e);
+			blk->type = get_num(&p, e);
+			blk->copy = get_num(&p, e);
+
+			if (print) {
+				printf("B %lu offset=%lu len=%lu %s", pid,
+				       blk->offset, blk->len,
+				       type_name(blk->type));
+				if (blk->copy)
+					printf(" copy=%lu", blk->copy - 1);
+				printf("\n");
+			}
+			break;
+		case TRACE_SPAWN:
+			call = find_call(calls, *nr_calls, pid);
+			call->runs = grow(call->runs, call->nr_runs,
+					  sizeof (rp_run));
+			call->nr_runs++;
+
+			if (!print)
+				break;
+
+			i = get_num(&p, e);
+			usec = get_num(&p, e);
+			argc = get_num(&p, e);
+			printf("G %lu gpg=%lu +%lu", pid, i, usec);
+			for (i = 0; i < argc; i++) {
+				s = get_str(&p, e, &len);
+				printf(len ? " " : " \"\"");
+				pr_text(s, len);
+			}
+			printf("\n");
+			break;
+		case TRACE_IO:
+			call = find_call(calls, *nr_calls, pid);
+			if (call->nr_runs == 0)
+				fatal(0, "Trace has I/O before a GPG run");
+			run = &call->runs[call->nr_runs - 1];
+			run->events = grow(run->events, run->nr_events,
+					   sizeof (rp_event));
+			ev = &run->events[run->nr_events++];
+			i = get_num(&p, e);
+			ev->stream = get_num(&p, e);
+			ev->usec = get_num(&p, e);
+			ev->bytes = get_num(&p, e);
+			s = get_str(&p, e, &len);
+
+			if (print) {
+				printf("I %lu gpg=%lu %s +%lu bytes=%lu", pid,
+				       i, (ev->stream == 0 ? "stdin" :
+					   ev->stream == 1 ? "stdout" :
+					   "stderr"), ev->usec, ev->bytes);
+				if (len > 0) {
+					printf(" \"");
+					pr_text(s, len);
+					printf("\"");
+				}
+				printf("\n");
+			}
+			break;
+		case TRACE_EXIT:
+			call = find_call(calls, *nr_calls, pid);
+			if (call->nr_runs == 0)
+				fatal(0, "Trace has an exit before a GPG run");
+			run = &call->runs[call->nr_runs - 1];
+			run->reaped = 1;
+			i = get_num(&p, e);
+			run->status = get_num(&p, e);
+			run->elapsed = get_num(&p, e);
+
+			if (print) {
+				printf("X %lu gpg=%lu ", pid, i);
+				pr_status((int) run->status);
+				printf(" real=%lu", run->elapsed);
+				printf(" user=%lu", get_num(&p, e));
+				printf(" sys=%lu", get_num(&p, e));
+				printf(" maxrss=%luk\n", get_num(&p, e));
+			}
+			break;
+		default:
+			/* Newer record types are skipped. */
+			break;
+		}
+
+		p = e;
+	}
+
+	free(data);
+
+	return calls;
+}
+
+/**
+ * Fill a buffer with lines of text that hold no PGP markers.
+ *
+ * @param  buf  The buffer.
+ * @param  len  Its size in bytes.
+ * @return      Nothing.
+ */
+static void fill_text(char *buf, unsigned long len)
+{
+	static const char line[] = "replayed message text\n";
+	unsigned long i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = line[i % (sizeof (line) - 1)];
+}
+
+/**
+ * Make up a PGP block of a given size.  The body is derived from the block
+ * number so that distinct blocks are not taken for copies of each other.
+ *
+ * @param  buf  Where the block goes.
+ * @param  len  The size of the block in bytes.
+ * @param  type The pinegpg_armor of the block.
+ * @param  nr   The block number.
+ * @return      Zero, or -1 if the block can not be that small.
+ */
+static int make_block(char *buf, unsigned long len, unsigned long type,
+		      int nr)
+{
+	const char *begin, *end;
+	unsigned long i, body;
+
+	if (armor_lines(type, &begin, &end) == -1 ||
+	    len < strlen(begin) + strlen(end))
+		return -1;
+
+	body = len - strlen(begin) - strlen(end);
+
+	memcpy(buf, begin, strlen(begin));
+	buf += strlen(begin);
+
+	for (i = 0; i < body; i++)
+		buf[i] = ((i + 1) % 65 == 0) ? '\n' :
+			 'A' + (nr + i / 65) % 26 + (i % 2) * ('a' - 'A');
+	if (body > 0)
+		buf[body - 1] = '\n';
+
+	/* The import filter only passes on blocks that start like a key. */
+	if (type == PINEGPG_ARMOR_PUBLIC_KEY && body > 4)
+		memcpy(buf, "mwQA", 4);
+
+	memcpy(buf + body, end, strlen(end));
+
+	return 0;
+}
+
+/**
+ * Make up a message like the one a traced call was given.
+ *
+ * @param  call  The call.
+ * @return       The message, call->len bytes long.
+ */
+static char *make_message(const rp_call *call)
+{
+	int i;
+	char *buf;
+	const rp_block *blk;
+
+	buf = malloc(call->len + 1);
+	if (buf == NULL)
+		fatal(errno, "Failed to make up a message");
+
+	fill_text(buf, call->len);
+
+	for (i = 0; i < call->nr_blocks; i++) {
+		blk = &call->blocks[i];
+		if (blk->offset + blk->len > call->len)
+			continue;
+
+		if (blk->offset > 0)
+			buf[blk->offset - 1] = '\n';
+
+		if (blk->copy > 0 && blk->copy - 1 + blk->len <= call->len)
+			memcpy(buf + blk->offset, buf + blk->copy - 1,
+			       blk->len);
+		else if (make_block(buf + blk->offset, blk->len, blk->type,
+				    i) == -1)
+			fprintf(stderr, "%s: block %d is too small to make "
+				"up\n", program_name, i);
+	}
+
+	return buf;
+}
+
+/**
+ * Write the plan for the GPG stand-in: one "G <status> <events>" line per
+ * run, each followed by "<stream> <usec> <bytes>" lines.
+ *
+ * @param  file  The plan file.
+ * @param  call  The call.
+ * @return       Nothing.
+ */
+static void write_plan(const char *file, const rp_call *call)
+{
+	int i, j;
+	FILE *f;
+	const rp_run *run;
+
+	f = fopen(file, "w");
+	if (f == NULL)
+		fatal(errno, "Failed to write %s", file);
+
+	for (i = 0; i < call->nr_runs; i++) {
+		run = &call->runs[i];
+		fprintf(f, "G %lu %d\n", (run->reaped ? run->status : 0),
+			run->nr_events);
+		for (j = 0; j < run->nr_events; j++)
+			fprintf(f, "%lu %lu %lu\n", run->events[j].stream,
+				run->events[j].usec, run->events[j].bytes);
+	}
+
+	if (fclose(f) == EOF)
+		fatal(errno, "Failed to write %s", file);
+}
+
+static void write_file(const char *file, const char *data, size_t len)
+{
+	int f;
+	ssize_t bytes;
+
+	f = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (f == -1)
+		fatal(errno, "Failed to write %s", file);
+
+	while (len > 0) {
+		bytes = write(f, data, len);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			fatal(errno, "Failed to write %s", file);
+		}
+		data += bytes;
+		len -= bytes;
+	}
+
+	close(f);
+}
+
+/**
+ * Replay one call of a trace through pine.gpg.
+ *
+ * @param  call     The call.
+ * @param  nr       Its number in the trace.
+ * @param  pinegpg  The pine.gpg binary.
+ * @param  self     This binary, to stand in for GPG.
+ * @return          Nothing.
+ */
+static void replay(const rp_call *call, int nr, const char *pinegpg,
+		   const char *self)
+{
+	int i, n = 0, s;
+	char dir[64], plan[80], seq[80], message[80], result[80], limits[64];
+	char plan_env[128], seq_env[128];
+	char **args, *buf;
+	unsigned long recorded = 0, replayed;
+	struct timeval start, end;
+	struct stat sbuf;
+	pid_t pid;
+
+	snprintf(dir, sizeof (dir), "/tmp/pine.gpg-replay.%ld.%d",
+		 (long) getpid(), nr);
+	if (mkdir(dir, S_IRWXU) == -1)
+		fatal(errno, "Failed to make %s", dir);
+
+	snprintf(plan, sizeof (plan), "%s/plan", dir);
+	snprintf(seq, sizeof (seq), "%s/seq", dir);
+	snprintf(message, sizeof (message), "%s/message", dir);
+	snprintf(result, sizeof (result), "%s/result", dir);
+	snprintf(plan_env, sizeof (plan_env), PLAN_ENV "=%s", plan);
+	snprintf(seq_env, sizeof (seq_env), SEQ_ENV "=%s", seq);
+
+	write_plan(plan, call);
+	write_file(seq, "", 0);
+
+	if (call->kind == TRACE_PROTECT) {
+		buf = malloc(call->len + 1);
+		if (buf == NULL)
+			fatal(errno, "Failed to make up a message");
+		fill_text(buf, call->len);
+		/* A message with no headers, so -P has a body to sign. */
+		if (call->how == PINEGPG_MIME_SIGN && call->len > 0)
+			buf[0] = '\n';
+	} else
+		buf = make_message(call);
+
+	write_file(message, buf, call->len);
+	free(buf);
+
+	args = malloc(sizeof (char *) * (16 + call->nr_rcpts + 1));
+	if (args == NULL)
+		fatal(errno, "Failed to build pine.gpg arguments");
+
+	args[n++] = (char *) pinegpg;
+	args[n++] = "-g";
+	args[n++] = (char *) self;
+
+	if (call->kind == TRACE_PROTECT) {
+		args[n++] = (call->how == PINEGPG_SIGN      ? "-S" :
+			     call->how == PINEGPG_ENCRYPT   ? "-E" :
+			     call->how == PINEGPG_MIME_SIGN ? "-P" : "-B");
+		args[n++] = "-p";
+		args[n++] = "never";
+	} else if (call->kind == TRACE_IMPORT)
+		args[n++] = "-I";
+	else
+		args[n++] = "-d";
+
+	if (call->max_block > 0 || call->max_message > 0) {
+		snprintf(limits, sizeof (limits), "block=%lu,message=%lu",
+			 call->max_block, call->max_message);
+		args[n++] = "-l";
+		args[n++] = limits;
+	}
+
+	args[n++] = "-r";
+	args[n++] = result;
+	args[n++] = "-i";
+	args[n++] = message;
+
+	/* The recipients only need to be there; the stand-in ignores them. */
+	if (call->kind == TRACE_PROTECT)
+		for (i = 0; i < (int) call->nr_rcpts || i == 0; i++)
+			args[n++] = "replay@invalid";
+
+	args[n] = NULL;
+
+	gettimeofday(&start, NULL);
+
+	pid = fork();
+	if (pid == -1)
+		fatal(errno, "Failed to fork pine.gpg");
+
+	if (pid == 0) {
+		if (putenv(plan_env) != 0 || putenv(seq_env) != 0)
+			_exit(127);
+		i = open("/dev/null", O_WRONLY);
+		if (i != -1)
+			dup2(i, 1);
+		execv(pinegpg, args);
+		_exit(127);
+	}
+
+	while (waitpid(pid, &s, 0) == -1)
+		if (errno != EINTR)
+			fatal(errno, "Failed to reap pine.gpg");
+
+	gettimeofday(&end, NULL);
+
+	replayed = (end.tv_sec - start.tv_sec) * 1000000L +
+		   (end.tv_usec - start.tv_usec);
+
+	for (i = 0; i < call->nr_runs; i++)
+		recorded += call->runs[i].elapsed;
+
+	if (stat(seq, &sbuf) == -1)
+		sbuf.st_size = 0;
+
+	printf("call %d: %s %s, %lu bytes, %d blocks, %d of %d GPG runs, "
+	       "pine.gpg ", nr, kind_name(call->kind),
+	       mode_name(call->kind, call->how), call->len, call->nr_blocks,
+	       (int) sbuf.st_size, call->nr_runs);
+	pr_status(s);
+	printf("\n  recorded %lu.%06lu s in GPG, replayed in %lu.%06lu s\n",
+	       recorded / 1000000, recorded % 1000000,
+	       replayed / 1000000, replayed % 1000000);
+
+	free(args);
+	unlink(plan);
+	unlink(seq);
+	unlink(message);
+	unlink(result);
+	rmdir(dir);
+}
+
+/**
+ * Stand in for GPG during a replay.
+ *
+ * @param  plan  The plan file.
+ * @param  seq   The run counter file.
+ * @return       Does not return.
+ */
+static void stub(const char *plan, const char *seq)
+{
+	static const char line[] = "replayed gpg output\n";
+	int f, s, nr = 0, stream;
+	unsigned long status = 0, events = 0, usec, bytes, n, at;
+	char buf[BUF_SIZE];
+	struct stat sbuf;
+	struct timeval start, now;
+	struct timespec ts;
+	ssize_t got;
+	FILE *p;
+
+	gettimeofday(&start, NULL);
+
+	f = open(seq, O_WRONLY | O_APPEND);
+	if (f == -1 || write(f, "G", 1) != 1 || fstat(f, &sbuf) == -1)
+		_exit(2);
+	close(f);
+
+	while ((got = read(0, buf, sizeof (buf))) != 0)
+		if (got == -1 && errno != EINTR)
+			break;
+
+	p = fopen(plan, "r");
+	if (p == NULL)
+		_exit(2);
+
+	/* Find this run's line, skipping the events of those before it. */
+	while (fscanf(p, " G %lu %lu", &status, &events) == 2) {
+		if (++nr == sbuf.st_size)
+			break;
+		for (; events > 0; events--)
+			if (fscanf(p, "%d %lu %lu", &stream, &usec,
+				   &bytes) != 3)
+				_exit(2);
+	}
+
+	/* More runs than were traced: act as a quiet success. */
+	if (nr != sbuf.st_size)
+		_exit(0);
+
+	for (; events > 0; events--) {
+		if (fscanf(p, "%d %lu %lu", &stream, &usec, &bytes) != 3)
+			_exit(2);
+		if (stream != 1 && stream != 2)
+			continue;
+
+		gettimeofday(&now, NULL);
+		at = (now.tv_sec - start.tv_sec) * 1000000L +
+		     (now.tv_usec - start.tv_usec);
+		if (usec > at) {
+			ts.tv_sec = (usec - at) / 1000000;
+			ts.tv_nsec = (usec - at) % 1000000 * 1000;
+			while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+				;
+		}
+
+		for (n = 0; n < sizeof (buf); n++)
+			buf[n] = line[n % (sizeof (line) - 1)];
+
+		for (; bytes > 0; bytes -= got) {
+			n = (bytes < sizeof (buf)) ? bytes : sizeof (buf);
+			got = write(stream, buf, n);
+			if (got == -1 && errno == EINTR)
+				got = 0;
+			else if (got <= 0)
+				_exit(2);
+		}
+	}
+
+	fclose(p);
+
+	s = (int) status;
+	if (WIFSIGNALED(s)) {
+		signal(WTERMSIG(s), SIG_DFL);
+		raise(WTERMSIG(s));
+	}
+
+	_exit(WEXITSTATUS(s));
+}
+
+static void exit_usage(void)
+{
+	printf("Usage: %s [-g <pine.gpg>] <trace>\n"
+	       "       %s -p <trace>\n", program_name, program_name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, i, print = 0, nr_calls;
+	char *pinegpg = BINDIR "/pine.gpg", self[PATH_MAX];
+	ssize_t len;
+	rp_call *calls;
+
+	program_name = argv[0];
+
+	if (getenv(PLAN_ENV) != NULL && getenv(SEQ_ENV) != NULL)
+		stub(getenv(PLAN_ENV), getenv(SEQ_ENV));
+
+	while ((opt = getopt(argc, argv, "g:hp")) != -1) {
+		switch (opt) {
+		case 'g':	/* pine.gpg to replay through */
+			pinegpg = optarg;
+			break;
+		case 'p':	/* print the trace */
+			print = 1;
+			break;
+		default:
+			exit_usage();
+		}
+	}
+
+	if (optind != argc - 1)
+		exit_usage();
+
+	calls = read_trace(argv[optind], print, &nr_calls);
+	if (print)
+		return EXIT_SUCCESS;
+
+	/* pine.gpg is told to run this program as GPG. */
+	if (strchr(argv[0], '/') != NULL) {
+		if (realpath(argv[0], self) == NULL)
+			fatal(errno, "Failed to find %s", argv[0]);
+	} else {
+		len = readlink("/proc/self/exe", self, sizeof (self) - 1);
+		if (len == -1)
+			fatal(errno, "Failed to find %s; run it by its path",
+			      argv[0]);
+		self[len] = '\0';
+	}
+
+	for (i = 0; i < nr_calls; i++)
+		replay(&calls[i], i + 1, pinegpg, self);
+
+	return EXIT_SUCCESS;
+}
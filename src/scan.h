@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * scan.h - PGP block scanner.
+ */
+
+#include "libpinegpg.h"
+
+#ifndef SCAN_H
+#define SCAN_H 1
+
+#include <stddef.h>
+
+/* Sets of block types for find_block(). */
+#define PGP_TYPE(t)	(1U << (t))
+#define PGP_FILTERED	(PGP_TYPE(PINEGPG_ARMOR_MESSAGE) | \
+			 PGP_TYPE(PINEGPG_ARMOR_SIGNED_MESSAGE))
+#define PGP_KEYS	PGP_TYPE(PINEGPG_ARMOR_PUBLIC_KEY)
+#define PGP_ANY		(~0U)
+
+int find_block(const char *, const char *, const char *, unsigned int,
+	       pinegpg_block *);
+int armor_lines(pinegpg_armor, const char **, const char **);
+unsigned long block_hash(const char *, size_t);
+
+#endif /* SCAN_H */
@@ -20,44 +20,705 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <ctype.h>
+#include <signal.h>
 #include <unistd.h>
+#include <poll.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
 
+#include "libpinegpg.h"
 #include "pinegpg.h"
+#include "packet.h"
+#include "proc.h"
+#include "scan.h"
 #include "utility.h"
 
+#define MAX_KEYIDS 64
+
+/**
+ * Run GPG to completion with its stderr on /dev/null, and its stdin fed
+ * from a buffer or on /dev/null, keeping up to size bytes of its stdout.
+ *
+ * @param  config  The program configuration.
+ * @param  args    A list of arguments to be passed to gpg(1).
+ * @param  input   The data to feed GPG, or NULL for none.
+ * @param  len     The size of the data in bytes.
+ * @param  buf     Where to keep GPG's output, or NULL to discard it.
+ * @param  size    The size of buf in bytes.
+ * @return         The number of bytes kept, or -1 if GPG failed.
+ */
+static ssize_t run_quiet(const program_config *config, char * const *args,
+			 const char *input, const size_t len, char *buf,
+			 const size_t size)
+{
+	int n, s, pin[2] = { -1, -1 }, pout[2];
+	pid_t pid, feeder = -1;
+	char junk[BUF_SIZE];
+	ssize_t bytes, total = 0;
+
+	/* The feeder is started first so that it holds no copy of the
+	 * other pipe.
+	 */
+	if (input != NULL) {
+		if (pipe_cloexec(pin) == -1)
+			return -1;
+		feeder = start_feeder(input, len, pin);
+		if (feeder == -1) {
+			close(pin[0]);
+			close(pin[1]);
+			return -1;
+		}
+	}
+
+	if (pipe_cloexec(pout) == -1) {
+		pid = -1;
+		goto out_feeder;
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		close(pout[0]);
+		close(pout[1]);
+		goto out_feeder;
+	}
+
+	if (pid == 0) {
+		close(pout[0]);
+
+		n = open("/dev/null", O_RDWR);
+		if (n == -1 ||
+		    dup2((input == NULL) ? n : pin[0], 0) == -1 ||
+		    dup2(n, 2) == -1 ||
+		    dup2((buf == NULL) ? n : pout[1], 1) == -1)
+			_exit(127);
+
+		if (limit_gpg(&config->lib) == -1)
+			_exit(127);
+
+		execv(config->lib.gpg, args);
+		_exit(127);
+	}
+
+	close(pout[1]);
+	if (input != NULL) {
+		close(pin[0]);
+		pin[0] = -1;
+	}
+
+	for (;;) {
+		if (buf != NULL && (size_t) total < size)
+			bytes = read(pout[0], buf + total, size - total);
+		else
+			bytes = read(pout[0], junk, sizeof (junk));
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (bytes == 0)
+			break;
+		if (buf != NULL && (size_t) total < size)
+			total += bytes;
+	}
+
+	close(pout[0]);
+
+	if (wait_child(pid, &s, NULL) == -1)
+		pid = -1;
+
+out_feeder:
+	/* GPG may stop reading early, which the feeder dies of. */
+	if (feeder != -1) {
+		if (pid == -1)
+			kill(feeder, SIGKILL);
+		if (pin[0] != -1)
+			close(pin[0]);
+		wait_child(feeder, &n, NULL);
+	}
+
+	if (pid == -1)
+		return -1;
+
+	return (WIFEXITED(s) && WEXITSTATUS(s) == 0) ? total : -1;
+}
+
+/**
+ * Check GPG's --with-colons key listing for a primary key that is valid
+ * and usable for encryption.
+ *
+ * @param  buf  The key listing.
+ * @param  len  The size of the key listing in bytes.
+ * @return      One if such a key was found, or zero if not.
+ */
+static int has_usable_key(const char *buf, const ssize_t len)
+{
+	int i;
+	const char *e, *f, *p, *q;
+
+	e = buf + len;
+	for (p = buf; p < e; p = q + 1) {
+		q = memchr(p, '\n', e - p);
+		if (q == NULL)
+			q = e;
+
+		/* Skip revoked, expired, disabled, and invalid keys. */
+		if ((q - p) < 5 || memcmp(p, "pub:", 4) != 0 ||
+		    memchr("rdein", p[4], 5) != NULL)
+			continue;
+
+		/* Field 12 holds the usable capabilities of the whole key. */
+		for (i = 0, f = p; f < q && i < 11; f++)
+			if (*f == ':')
+				i++;
+
+		for (; f < q && *f != ':'; f++)
+			if (*f == 'E')
+				return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Check GPG's --with-colons key listing for a primary key or subkey with
+ * one of the given key IDs.
+ *
+ * @param  buf     The key listing.
+ * @param  len     The size of the key listing in bytes.
+ * @param  ids     The key IDs to look for.
+ * @param  nr_ids  The number of key IDs.
+ * @return         One if one was found, or zero if not.
+ */
+static int has_keyid(const char *buf, const ssize_t len,
+		     const pgp_keyid *ids, const int nr_ids)
+{
+	int i, j;
+	char hex[2 * KEYID_LEN + 1];
+	const char *e, *f, *p, *q;
+
+	e = buf + len;
+	for (p = buf; p < e; p = q + 1) {
+		q = memchr(p, '\n', e - p);
+		if (q == NULL)
+			q = e;
+
+		if ((q - p) < 4 || (memcmp(p, "pub:", 4) != 0 &&
+				    memcmp(p, "sub:", 4) != 0 &&
+				    memcmp(p, "sec:", 4) != 0 &&
+				    memcmp(p, "ssb:", 4) != 0))
+			continue;
+
+		/* Field 5 holds the key ID. */
+		for (i = 0, f = p; f < q && i < 4; f++)
+			if (*f == ':')
+				i++;
+
+		if ((q - f) < 2 * KEYID_LEN)
+			continue;
+
+		for (i = 0; i < nr_ids; i++) {
+			for (j = 0; j < KEYID_LEN; j++)
+				sprintf(hex + 2 * j, "%02X", ids[i][j]);
+			if (strncasecmp(f, hex, 2 * KEYID_LEN) == 0)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check GPG's --with-colons key listing for every key in it having a
+ * primary key or subkey with one of the given key IDs.
+ *
+ * @param  buf     The key listing.
+ * @param  len     The size of the key listing in bytes.
+ * @param  ids     The key IDs to look for.
+ * @param  nr_ids  The number of key IDs.
+ * @return         One if every key has one, or zero if not or if the
+ *                 listing holds no keys.
+ */
+static int all_have_keyid(const char *buf, const ssize_t len,
+			  const pgp_keyid *ids, const int nr_ids)
+{
+	const char *e, *p, *q;
+
+	e = buf + len;
+	for (p = buf; p < e && (e - p < 4 || memcmp(p, "pub:", 4) != 0);
+	     p = q + 1) {
+		q = memchr(p, '\n', e - p);
+		if (q == NULL)
+			return 0;
+	}
+
+	if (p >= e)
+		return 0;
+
+	/* Each key runs from its pub line to the next one. */
+	while (p < e) {
+		for (q = p; (q = memchr(q, '\n', e - q)) != NULL; ) {
+			q++;
+			if (e - q >= 4 && memcmp(q, "pub:", 4) == 0)
+				break;
+		}
+		if (q == NULL)
+			q = e;
+
+		if (!has_keyid(p, q - p, ids, nr_ids))
+			return 0;
+		p = q;
+	}
+
+	return 1;
+}
+
+/**
+ * Check GPG's --status-fd output from --verify for a good, valid signature
+ * by one of the keys in a --with-colons key listing, and no signature that
+ * is not.
+ *
+ * @param  status    The status output.
+ * @param  len       The size of the status output in bytes.
+ * @param  keys      The key listing.
+ * @param  keys_len  The size of the key listing in bytes.
+ * @return           One if so, or zero if not.
+ */
+static int good_own_sig(const char *status, const ssize_t len,
+			const char *keys, const ssize_t keys_len)
+{
+	int i, good = 0, valid = 0;
+	unsigned int byte;
+	const char *e, *f, *p, *q;
+	pgp_keyid id;
+
+	static const char prefix[] = "[GNUPG:] ";
+	static const char *bad[] = { "BADSIG ", "ERRSIG ", "EXPSIG ",
+				     "EXPKEYSIG ", "REVKEYSIG ", NULL };
+
+	e = status + len;
+	for (p = status; p < e; p = q + 1) {
+		q = memchr(p, '\n', e - p);
+		if (q == NULL)
+			q = e;
+
+		if ((size_t) (q - p) < sizeof (prefix) - 1 ||
+		    memcmp(p, prefix, sizeof (prefix) - 1) != 0)
+			continue;
+		p += sizeof (prefix) - 1;
+
+		for (i = 0; bad[i] != NULL; i++)
+			if ((size_t) (q - p) >= strlen(bad[i]) &&
+			    memcmp(p, bad[i], strlen(bad[i])) == 0)
+				return 0;
+
+		if (q - p >= 9 && memcmp(p, "VALIDSIG ", 9) == 0)
+			valid = 1;
+
+		if (q - p < 8 || memcmp(p, "GOODSIG ", 8) != 0)
+			continue;
+
+		/* The key ID, or the fingerprint that ends with it. */
+		for (f = p + 8; f < q && isxdigit((unsigned char) *f); f++)
+			;
+		if (f - (p + 8) < 2 * KEYID_LEN)
+			return 0;
+
+		for (i = 0, f -= 2 * KEYID_LEN; i < KEYID_LEN; i++, f += 2) {
+			if (sscanf(f, "%2x", &byte) != 1)
+				return 0;
+			id[i] = byte;
+		}
+
+		if (!has_keyid(keys, keys_len, &id, 1))
+			return 0;
+		good = 1;
+	}
+
+	return good && valid;
+}
+
+/**
+ * Decide whether the message is already protected the way the user asked,
+ * as when a postponed draft or an encrypted message is sent again, so
+ * that GPG need not wrap it a second time.  Only a message that is one
+ * PGP block with nothing but white space around it qualifies.
+ *
+ * Under the match policy an encrypted message only counts when encrypting,
+ * and only if every recipient has a key it was encrypted to; a clearsigned
+ * message only counts when signing, and only if GPG finds its signature
+ * good and made by one of the user's secret keys (or the -k key), so that
+ * a draft edited after it was signed is signed again.  Key IDs are read
+ * natively from the packets, and GPG is asked once to list the keys they
+ * are compared with, before any signature is checked.  All recipients are
+ * listed together, so every key they name must be one the message was
+ * encrypted to; a recipient naming several keys may thus have the message
+ * encrypted again when that was not needed.
+ * Signing and encrypting is never skipped, since the signature is hidden
+ * inside the encryption.
+ *
+ * @param  config  The program configuration.
+ * @param  gpg     The process name to give GPG.
+ * @param  input   The message.
+ * @param  size    The size of the message in bytes.
+ * @param  resp    The sending function: 's', 'e', or 'b'.
+ * @return         One if the message should be sent as it is, or zero if
+ *                 not.
+ */
+static int already_protected(const program_config *config, char *gpg,
+			     const char *input, const ssize_t size,
+			     const char resp)
+{
+	int i, j, n, good;
+	char **args;
+	char buf[16 * BUF_SIZE], status[4 * BUF_SIZE];
+	const char *e = input + size, *p;
+	unsigned char *data;
+	ssize_t bytes, got;
+	size_t len;
+	pinegpg_block blk;
+	pgp_keyid ids[MAX_KEYIDS];
+
+	static const char sig_begin[] = "-----BEGIN PGP SIGNATURE-----\n";
+
+	if (config->skip == skip_never ||
+	    !find_block(input, input, e, PGP_FILTERED, &blk))
+		return 0;
+
+	for (p = input; p < blk.begin; p++)
+		if (!isspace((unsigned char) *p))
+			return 0;
+
+	for (p = blk.end; p < e; p++)
+		if (!isspace((unsigned char) *p))
+			return 0;
+
+	if (config->skip == skip_any)
+		return 1;
+
+	if (blk.type == PINEGPG_ARMOR_MESSAGE && resp == 'e') {
+		p = memchr(blk.begin, '\n', blk.end - blk.begin) + 1;
+	} else if (blk.type == PINEGPG_ARMOR_SIGNED_MESSAGE && resp == 's') {
+		for (p = blk.begin; p != NULL && p < blk.end; p++) {
+			p = memchr(p, '\n', blk.end - p);
+			if (p != NULL && (size_t) (blk.end - p - 1) >
+					 sizeof (sig_begin) - 1 &&
+			    memcmp(p + 1, sig_begin,
+				   sizeof (sig_begin) - 1) == 0)
+				break;
+		}
+		if (p == NULL || p >= blk.end)
+			return 0;
+		p += sizeof (sig_begin);
+	} else {
+		return 0;
+	}
+
+	data = armor_decode(p, blk.end, &len);
+	if (data == NULL)
+		return 0;
+
+	if (blk.type == PINEGPG_ARMOR_MESSAGE)
+		n = pkesk_keyids(data, len, ids, MAX_KEYIDS);
+	else
+		n = sig_keyids(data, len, ids, MAX_KEYIDS);
+
+	free(data);
+
+	if (n <= 0 ||
+	    (blk.type == PINEGPG_ARMOR_MESSAGE && config->lib.nr_rcpts == 0))
+		return 0;
+
+	args = malloc(sizeof (char *) * (10 + config->lib.nr_rcpts));
+	if (args == NULL)
+		return 0;
+
+	i = 0;
+	args[i++] = gpg;
+	args[i++] = "--batch";
+	args[i++] = "--no-tty";
+	args[i++] = "--no-auto-check-trustdb";
+	args[i++] = "--with-colons";
+
+	if (blk.type == PINEGPG_ARMOR_SIGNED_MESSAGE) {
+		args[i++] = "--list-secret-keys";
+		if (config->lib.default_key != NULL) {
+			args[i++] = "--";
+			args[i++] = config->lib.default_key;
+		}
+		args[i++] = NULL;
+
+		bytes = run_quiet(config, args, NULL, 0, buf, sizeof (buf));
+		if (bytes == -1 || (size_t) bytes >= sizeof (buf) ||
+		    !has_keyid(buf, bytes, ids, n)) {
+			free(args);
+			return 0;
+		}
+
+		/* The key ID only says who claims to have signed it. */
+		i = 4;
+		args[i++] = "--status-fd";
+		args[i++] = "1";
+		args[i++] = "--verify";
+		args[i++] = "-";
+		args[i++] = NULL;
+
+		got = run_quiet(config, args, blk.begin, blk.end - blk.begin,
+				status, sizeof (status));
+		good = got != -1 && (size_t) got < sizeof (status) &&
+		       good_own_sig(status, got, buf, bytes);
+		free(args);
+
+		return good;
+	}
+
+	args[i++] = "--list-keys";
+	args[i++] = "--";
+	for (j = 0; j < config->lib.nr_rcpts; j++)
+		args[i++] = config->lib.rcpts[j];
+	args[i++] = NULL;
+
+	/* GPG fails if any recipient has no key, and a listing that did not
+	 * fit can not be checked in full.
+	 */
+	bytes = run_quiet(config, args, NULL, 0, buf, sizeof (buf));
+	free(args);
+
+	return bytes != -1 && (size_t) bytes < sizeof (buf) &&
+	       all_have_keyid(buf, bytes, ids, n);
+}
+
+/**
+ * Start speculative work in the background while the user decides between
+ * signing and encrypting: read the message into the page cache, have GPG
+ * start gpg-agent and load the secret keyring, and look up each recipient.
+ * Recipients with no usable key are reported one per line on a pipe so the
+ * user can be warned before committing to encryption.
+ *
+ * None of this is needed for the message to be sent, so any failure here
+ * is silently ignored.
+ *
+ * @param  config  The program configuration.
+ * @param  gpg     The process name to give GPG.
+ * @param  report  Set to the read end of the report pipe, or -1.
+ * @return         The process ID of the warm-up process, or -1.
+ */
+static pid_t warm_up(const program_config *config, char *gpg, int *report)
+{
+	int f, i, pr[2];
+	pid_t pid;
+	char buf[4 * BUF_SIZE];
+	char *args[9];
+	ssize_t bytes;
+
+	*report = -1;
+
+	if (pipe_cloexec(pr) == -1)
+		return -1;
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == -1) {
+		close(pr[0]);
+		close(pr[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(pr[0]);
+		setpgid(0, 0);
+
+		f = open(config->input_file, O_RDONLY);
+		if (f != -1) {
+			while (read(f, buf, sizeof (buf)) > 0)
+				;
+			close(f);
+		}
+
+		i = 0;
+		args[i++] = gpg;
+		args[i++] = "--batch";
+		args[i++] = "--no-tty";
+		args[i++] = "--no-auto-check-trustdb";
+		args[i++] = "--list-secret-keys";
+		if (config->lib.default_key != NULL)
+			args[i++] = config->lib.default_key;
+		args[i++] = NULL;
+		run_quiet(config, args, NULL, 0, NULL, 0);
+
+		args[4] = "--with-colons";
+		args[5] = "--list-keys";
+		args[6] = "--";
+		args[8] = NULL;
+		for (i = 0; i < config->lib.nr_rcpts; i++) {
+			args[7] = config->lib.rcpts[i];
+			bytes = run_quiet(config, args, NULL, 0, buf, sizeof (buf));
+			if (bytes == -1 || !has_usable_key(buf, bytes)) {
+				write(pr[1], config->lib.rcpts[i],
+				      strlen(config->lib.rcpts[i]));
+				write(pr[1], "\n", 1);
+			}
+		}
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	setpgid(pid, pid);
+	close(pr[1]);
+	*report = pr[0];
+
+	return pid;
+}
+
+/**
+ * Prompt for the sending function, passing on any warnings from the
+ * warm-up process as they arrive.
+ *
+ * @param  report  The read end of the warm-up report pipe, or -1.
+ * @return         The user's choice: 's', 'e', 'b', or 'a'.
+ */
+static char prompt(int report)
+{
+	int n;
+	char c, *nl;
+	char line[1024];
+	size_t len = 0;
+	ssize_t bytes;
+	struct pollfd fds[2];
+
+	const char *ask = "\n  [PINE.GPG] (S)ign, (E)ncrypt, (B)oth, or "
+			  "(A)bort (s/e/b/a)? ";
+
+	printf("%s", ask);
+	fflush(stdout);
+
+	for (;;) {
+		fds[0].fd = 0;
+		fds[0].events = POLLIN;
+		fds[1].fd = report;
+		fds[1].events = POLLIN;
+
+		n = poll(fds, (report == -1) ? 1 : 2, -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return 'a';
+		}
+
+		if (report != -1 && fds[1].revents) {
+			bytes = read(report, line + len, sizeof (line) - len);
+			if (bytes <= 0) {
+				report = -1;
+				continue;
+			}
+			len += bytes;
+
+			while ((nl = memchr(line, '\n', len)) != NULL ||
+			       len == sizeof (line)) {
+				if (nl == NULL)
+					nl = line + len - 1;
+				printf("\n  [PINE.GPG] Warning: no usable key "
+				       "found for %.*s", (int) (nl - line),
+				       line);
+				len -= nl + 1 - line;
+				memmove(line, nl + 1, len);
+			}
+			printf("%s", ask);
+			fflush(stdout);
+		}
+
+		if (fds[0].revents) {
+			bytes = read(0, &c, 1);
+			if (bytes == -1 && errno == EINTR)
+				continue;
+			if (bytes != 1)
+				return 'a';
+
+			switch (c) {
+			case 's': case 'e': case 'b': case 'a':
+				return c;
+			}
+
+			printf("%s", ask);
+			fflush(stdout);
+		}
+	}
+}
+
+/**
+ * Open where the filtered message goes, truncating the input file.
+ *
+ * @param  config  The program configuration.
+ * @return         The file descriptor.
+ */
+static int open_output(const program_config *config)
+{
+	int f;
+
+	if (config->streaming)
+		return 1;
+
+	f = open(config->input_file, O_WRONLY | O_TRUNC);
+	if (f == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to open input file for writing");
+
+	return f;
+}
+
+/*
+ * PGP/MIME output is only given to the sink once GPG has succeeded, so it
+ * can go straight to the output instead of being held in memory, and the
+ * body is written from the input buffer without another copy.
+ */
+typedef struct _late_out {
+	outbuf out;
+	const program_config *config;
+} late_out;
+
+static int late_write(void *ctx, const char *data, size_t len)
+{
+	late_out *lo = ctx;
+
+	if (lo->out.fd == -1)
+		lo->out.fd = open_output(lo->config);
+
+	out_write(&lo->out, data, len);
+	return 0;
+}
+
 /**
  * Sending filter for encrypting and/or signing.
  *
  * @param  config  The program configuration.
  * @return         Nothing.
  */
-void sending(const pinegpg_config *config)
+void sending(const program_config *config)
 {
-	int f, i, s, pout[2];
-	int arg_idx = 0, nr_args = 14 + config->nr_rcpts * 2;
-	pid_t pid;
-	ssize_t bytes, wrote = 0, total = 0, gpg_out_size = BUF_SIZE;
-	const size_t buf_size = gpg_out_size;
-	char buf[buf_size], resp;
-	char **gpg_args, *gpg_out, *gpg, *p;
+	int f, s, status, report;
+	pid_t warm;
+	ssize_t input_size;
+	char resp;
+	char *gpg, *p, *input;
 	struct termios termio, termio_orig;
+	struct stat sbuf;
+	pinegpg_how how = PINEGPG_SIGN;
+	pinegpg_sink sink;
+	late_out lo;
 
 	const char *result_ok    = "Sending filter completed successfully.",
-		   *result_abort = "Sending filter aborted.";
-
-	gpg_args = malloc(sizeof (char *) * nr_args);
-	if (gpg_args == NULL)
-		die_x(EXIT_FAILURE, errno, config->result_file,
-		      "Failed to create array for GPG arguments list");
+		   *result_abort = "Sending filter aborted.",
+		   *result_kept  = "Sending filter left the already protected "
+				   "message as it was.";
 
-	p = strrchr(config->gpg, '/');
+	p = strrchr(config->lib.gpg, '/');
 	if (p == NULL)
-		p = config->gpg;
+		p = config->lib.gpg;
 	else
 		p++;
 
@@ -66,26 +727,13 @@ void sending(const pinegpg_config *config)
 		die_x(EXIT_FAILURE, errno, config->result_file,
 		      "Failed to allocate memory for GPG process name");
 
-	gpg_args[arg_idx++] = gpg;
-	gpg_args[arg_idx++] = "--armor";
-	gpg_args[arg_idx++] = "--set-filename";
-	gpg_args[arg_idx++] = "";
-	gpg_args[arg_idx++] = "--output";
-	gpg_args[arg_idx++] = "-";
-
-	if (config->default_key != NULL) {
-		gpg_args[arg_idx++] = "--default-key";
-		gpg_args[arg_idx++] = config->default_key;
-	}
-
-	if (config->verbose > 0)
-		gpg_args[arg_idx++] = "--verbose";
-
-	if (config->verbose > 1)
-		gpg_args[arg_idx++] = "--verbose";
-
 	switch (config->mode) {
 	case sending_mode:
+		if (config->streaming)
+			die_x(EXIT_FAILURE, 0, config->result_file,
+			      "Sending filter can not prompt when reading the "
+			      "message from stdin; use -S, -E, or -B");
+
 		if (tcgetattr(0, &termio) == -1)
 			die_x(EXIT_FAILURE, errno, config->result_file,
 			      "Failed to get terminal attributes");
@@ -100,17 +748,21 @@ void sending(const pinegpg_config *config)
 			die_x(EXIT_FAILURE, errno, config->result_file,
 			      "Failed to set terminal attributes");
 
-		for (i = 0; i < 1;) {
-			printf("\n"
-			       "  [PINE.GPG] (S)ign, (E)ncrypt, (B)oth, or "
-			       "(A)bort (s/e/b/a)? ");
-			resp = getchar();
-			switch (resp) {
-				case 's': case 'e': case 'b': case 'a': i++;
-			}
-		}
+		/* Use the time the user spends at the prompt to get GPG
+		 * ready for whichever function they choose.
+		 */
+		warm = warm_up(config, gpg, &report);
+
+		resp = prompt(report);
 		printf("\n");
 
+		if (warm != -1) {
+			kill(-warm, SIGTERM);
+			while (waitpid(warm, &s, 0) == -1 && errno == EINTR)
+				;
+			close(report);
+		}
+
 		if (tcsetattr(0, TCSANOW, &termio_orig) == -1)
 			die_x(EXIT_FAILURE, errno, config->result_file,
 			      "Failed to restore terminal attributes");
@@ -118,123 +770,85 @@ void sending(const pinegpg_config *config)
 	case sign_mode:    resp = 's'; break;
 	case encrypt_mode: resp = 'e'; break;
 	case both_mode:    resp = 'b'; break;
+	case mime_sign_mode: resp = 'm'; break;
 	default:	   resp = 'a'; break;
 	}
 
 	switch (resp) {
-	case 'a':
+	case 's':  how = PINEGPG_SIGN;         break;
+	case 'e':  how = PINEGPG_ENCRYPT;      break;
+	case 'b':  how = PINEGPG_SIGN_ENCRYPT; break;
+	case 'm':  how = PINEGPG_MIME_SIGN;    break;
+	default:
 		die_x(EXIT_FAILURE, 0, config->result_file, result_abort);
-	case 's':
-		gpg_args[arg_idx++] = "--clearsign";
-		break;
-	case 'b':
-		gpg_args[arg_idx++] = "--sign";
-	case 'e':
-		gpg_args[arg_idx++] = "--encrypt";
-		for (i = 0; i < config->nr_rcpts; i++) {
-			gpg_args[arg_idx++] = "--recipient";
-			gpg_args[arg_idx++] = config->rcpts[i];
-		}
 	}
 
-	gpg_args[arg_idx++] = config->input_file;
-	gpg_args[arg_idx++] = NULL;
-
-	if (pipe(pout) == -1)
-		die_x(EXIT_FAILURE, errno, config->result_file,
-		      "Failed to create pipe for stdout");
-
-	pid = fork();
-	if (pid == -1)
-		die_x(EXIT_FAILURE, errno, config->result_file,
-		      "Failed to create fork for GPG");
-
-	if (pid == 0) {
-		close(pout[0]);
-
-		if (dup2(pout[1], 1) == -1)
+	if (config->streaming) {
+		input = read_stream(0, &input_size, config->result_file);
+	} else {
+		f = open(config->input_file, O_RDONLY);
+		if (f == -1 || fstat(f, &sbuf) == -1)
 			die_x(EXIT_FAILURE, errno, config->result_file,
-			      "Failed to reassign GPG stdout to pipe");
-
-		execv(config->gpg, gpg_args);
-
-		die_x(127, errno, config->result_file, "Failed to execv(%s)",
-		      config->gpg);
+			      "Failed to open input file for reading");
+		input_size = sbuf.st_size;
+		input = read_input(f, input_size, config->result_file);
+		close(f);
 	}
 
-	close(pout[1]);
-
-	gpg_out = malloc(sizeof (char) * gpg_out_size);
-	if (gpg_out == NULL)
-		die_x(EXIT_FAILURE, errno, config->result_file,
-		      "Failed to allocate buffer for GPG output");
-
-	p = gpg_out;
-	while ((bytes = read(pout[0], &buf, buf_size)) != 0) {
-		if (bytes == -1) {
-			if (errno == EINTR)
-				continue;
-			else
-				die_x(EXIT_FAILURE, errno, config->result_file,
-				      "GPG stdout read error");
-		}
-
-		while ((bytes + total) >= gpg_out_size) {
-			gpg_out_size += buf_size;
-			gpg_out = realloc(gpg_out,
-					  sizeof (char) * gpg_out_size);
-			if (gpg_out == NULL)
-				die_x(EXIT_FAILURE, errno, config->result_file,
-				      "Failed to increase GPG output buffer "
-				      "size");
-			if (gpg_out_size > (bytes + total))
-				p = gpg_out + total;
+	if (resp != 'm' &&
+	    already_protected(config, gpg, input, input_size, resp)) {
+		if (config->streaming) {
+			out_init(&lo.out, 1, config->result_file);
+			out_write(&lo.out, input, input_size);
+			out_free(&lo.out);
 		}
+		die_x(EXIT_SUCCESS, 0, config->result_file, result_kept);
+	}
 
-		memcpy(p, &buf, bytes);
-		total += bytes;
-		p += bytes;
+	/* Nothing is written until GPG has succeeded, so a failure never
+	 * lets the unfiltered message through, even on a stream.
+	 */
+	out_init(&lo.out, -1, config->result_file);
+	out_sink(&lo.out, &sink, 0);
+
+	if (how == PINEGPG_MIME_SIGN) {
+		lo.config = config;
+		sink.write = late_write;
+		sink.read = NULL;
+		sink.ctx = &lo;
 	}
 
-	do {
-		while (waitpid(pid, &s, 0) == -1) {
-			if (errno == EINTR)
-				continue;
-			else
-				die_x(EXIT_FAILURE, errno, config->result_file,
-				      "Failed to reap GPG child process %d",
-				      pid);
-		}
-	} while (!WIFEXITED(s) && !WIFSIGNALED(s));
+	status = pinegpg_protect(&config->lib, how, input, input_size, &sink,
+				 &s);
 
-	if (WIFSIGNALED(s) && WTERMSIG(s))
+	if (status == PINEGPG_ERR_GPG && WIFSIGNALED(s))
 		die_x(EXIT_FAILURE, 0, config->result_file,
 		      "GPG process terminated by signal %d", WTERMSIG(s));
 
-	if (WEXITSTATUS(s) > 0)
+	if (status == PINEGPG_ERR_GPG && WEXITSTATUS(s) == 0)
+		die_x(EXIT_FAILURE, 0, config->result_file,
+		      "GPG made a signature the sending filter can not read");
+
+	if (status == PINEGPG_ERR_GPG)
 		die_x(EXIT_FAILURE, 0, config->result_file,
 		      "GPG process exited with status %d", WEXITSTATUS(s));
 
-	f = open(config->input_file, O_WRONLY | O_TRUNC);
-	if (f == -1)
-		die_x(EXIT_FAILURE, errno, config->result_file,
-		      "Failed to open input file for writing");
+	if (status == PINEGPG_ERR_INVALID && how == PINEGPG_MIME_SIGN)
+		die_x(EXIT_FAILURE, 0, config->result_file,
+		      "Sending filter needs a whole message, headers and body, "
+		      "to sign it as PGP/MIME; a multipart or encoded body "
+		      "must be 7-bit");
 
-	while ((bytes = write(f, gpg_out + wrote, total - wrote)) != 0) {
-		if (bytes == -1) {
-			if (errno == EINTR)
-				continue;
-			else
-				die_x(EXIT_FAILURE, errno, config->result_file,
-				      "Input file write error");
-		}
-		wrote += bytes;
-	}
+	if (status != PINEGPG_OK)
+		die_x(EXIT_FAILURE, (status == PINEGPG_ERR_SYSTEM) ? errno : 0,
+		      config->result_file, "Sending filter failed: %s",
+		      pinegpg_strerror(status));
 
-	if (total != wrote)
-		die_x(EXIT_FAILURE, 0, config->result_file,
-		      "Bytes wrote (%d) does not match output buffer size (%d)",
-		      wrote, total);
+	if (lo.out.fd == -1)
+		lo.out.fd = open_output(config);
+
+	f = lo.out.fd;
+	out_free(&lo.out);
 
 	close(f);
 
@@ -21,6 +21,6 @@
 #ifndef SENDING_H
 #define SENDING_H 1
 
-void sending(const pinegpg_config *);
+void sending(const program_config *);
 
 #endif /* SENDING_H */
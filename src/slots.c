@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * slots.c - Host-wide GPG process slots.
+ * created 19 Oct 2026
+ */
+
+/* For open file description locks (F_OFD_SETLK) where Linux has them. */
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pinegpg.h"
+#include "proc.h"
+#include "slots.h"
+
+#include "config.h"
+
+/*
+ * All filters on the host share one lock file.  Byte zero guards a pair
+ * of counters at the start of the file: the next ticket to hand out, and
+ * the ticket being served.  A filter takes a ticket and waits for its turn,
+ * so slots are given out in the order filters asked for them.  Bytes one
+ * through N are the slots themselves.
+ *
+ * While it waits, a filter holds a lock on a byte of its own in the queue
+ * region, one per ticket.  A ticket whose byte is not locked belongs to a
+ * filter that died or gave up, and whoever sees that moves the queue on.
+ * Being fcntl(2) locks, all of these are dropped by the kernel if a filter
+ * dies while holding one.
+ *
+ * Any user on the host can open the file, so any user can hold its locks.
+ * The limit is only a courtesy: if the file can not be used, or no slot
+ * comes within SLOT_TIMEOUT seconds, GPG is run without one and the
+ * result file says so.
+ *
+ * Where there are open file description locks, those are used: each
+ * slot_acquire() opens the file anew, so two threads of a libpinegpg
+ * user each hold their own slot, and releasing one does not release the
+ * other as closing a descriptor does with process-wide locks.
+ */
+#ifdef F_OFD_SETLK
+#define GET_LOCK  F_OFD_GETLK
+#define SET_LOCK  F_OFD_SETLK
+#else
+#define GET_LOCK  F_GETLK
+#define SET_LOCK  F_SETLK
+#endif
+
+#define SLOT_TIMEOUT 30
+#define QUEUE_BASE   ((off_t) 1 << 30)
+#define QUEUE_LEN    (1UL << 20)
+#define QUEUE_BYTE(t) (QUEUE_BASE + (off_t) ((t) % QUEUE_LEN))
+
+/* A lock attempt that failed only because the byte was taken. */
+#define LOCK_BUSY(e) ((e) == EACCES || (e) == EAGAIN)
+
+/**
+ * Set or clear a lock on a single byte of the slot file.
+ *
+ * @param  f     The file descriptor of the slot file.
+ * @param  type  F_WRLCK or F_UNLCK.
+ * @param  byte  The offset of the byte to lock.
+ * @return       Zero on success, or -1 with errno set.
+ */
+static int lock_byte(const int f, const short type, const off_t byte)
+{
+	struct flock fl;
+
+	fl.l_type   = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start  = byte;
+	fl.l_len    = 1;
+	fl.l_pid    = 0;
+
+	while (fcntl(f, SET_LOCK, &fl) == -1) {
+		if (errno == EINTR)
+			continue;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Tell whether another filter holds the lock on a byte of the slot file.
+ *
+ * @param  f     The file descriptor of the slot file.
+ * @param  byte  The offset of the byte.
+ * @return       One if so, zero if not, or -1 with errno set.
+ */
+static int byte_locked(const int f, const off_t byte)
+{
+	struct flock fl;
+
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start  = byte;
+	fl.l_len    = 1;
+	fl.l_pid    = 0;
+
+	if (fcntl(f, GET_LOCK, &fl) == -1)
+		return -1;
+
+	return fl.l_type != F_UNLCK;
+}
+
+/**
+ * Take the lock on the counters, waiting until a deadline at the latest.
+ *
+ * @param  f         The file descriptor of the slot file.
+ * @param  deadline  When to give up.
+ * @return           Zero on success, or -1 with errno set.
+ */
+static int lock_counters(const int f, const time_t deadline)
+{
+	struct timespec nap;
+
+	nap.tv_sec  = 0;
+	nap.tv_nsec = 1000000;
+
+	while (lock_byte(f, F_WRLCK, 0) == -1) {
+		if (!LOCK_BUSY(errno))
+			return -1;
+		if (time(NULL) >= deadline) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		nanosleep(&nap, NULL);
+	}
+
+	return 0;
+}
+
+/**
+ * Read or write the counters, with the lock on them held.  A new file
+ * reads as zeros.
+ *
+ * @param  f      The file descriptor of the slot file.
+ * @param  c      The next ticket and the ticket being served.
+ * @param  write  Non-zero to write them rather than read them.
+ * @return        Zero on success, or -1 with errno set.
+ */
+static int counters(const int f, unsigned long c[2], const int write)
+{
+	ssize_t bytes;
+
+	if (write)
+		return (pwrite(f, c, 2 * sizeof (c[0]), 0) ==
+			(ssize_t) (2 * sizeof (c[0]))) ? 0 : -1;
+
+	bytes = pread(f, c, 2 * sizeof (c[0]), 0);
+	if (bytes == -1)
+		return -1;
+	if (bytes < (ssize_t) (2 * sizeof (c[0])))
+		memset((char *) c + bytes, 0, 2 * sizeof (c[0]) - bytes);
+
+	return 0;
+}
+
+/**
+ * Open the slot file, creating it if need be.
+ *
+ * @param  path  The path of the slot file.
+ * @return       A file descriptor, or -1 with errno set.
+ */
+static int open_slots(const char *path)
+{
+	int f, e;
+	struct stat sbuf;
+
+	/* The directory may be world-writable, so never follow a link
+	 * planted there, and only use a plain file.
+	 */
+	f = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+		 S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (f != -1) {
+		/* The file is shared by every user on the host, so undo the
+		 * umask on the file just created.
+		 */
+		if (fchmod(f, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+			   S_IROTH | S_IWOTH) == -1)
+			goto fail;
+	} else if (errno == EEXIST) {
+		f = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+		if (f == -1)
+			return -1;
+	} else
+		return -1;
+
+	if (fstat(f, &sbuf) == -1)
+		goto fail;
+
+	if (!S_ISREG(sbuf.st_mode) || sbuf.st_nlink != 1) {
+		errno = EPERM;
+		goto fail;
+	}
+
+	return f;
+
+fail:
+	e = errno;
+	close(f);
+	errno = e;
+
+	return -1;
+}
+
+/**
+ * Wait for and take one of the host-wide GPG process slots, in the order
+ * they were asked for.  If the filter had to wait, the time spent waiting
+ * is noted.  If the slot file can not be used, or no slot comes within
+ * SLOT_TIMEOUT seconds, that is noted instead and no slot is taken.
+ *
+ * @param  config  The program configuration.
+ * @param  slot    Set to a descriptor to pass to slot_release(), or -1 if
+ *                 no slot was taken.
+ * @return         Zero.
+ */
+int slot_acquire(const pinegpg_config *config, int *slot)
+{
+	int f, i, held, queued = 0, waited = 0;
+	long ms;
+	char path[256];
+	unsigned long c[2], ticket = 0;
+	time_t deadline;
+	struct timeval start, end;
+	struct timespec nap;
+
+	*slot = -1;
+
+	if (config->max_gpg < 1)
+		return 0;
+
+	snprintf(path, sizeof (path), "%s/pine.gpg.slots", SLOT_DIR);
+
+	f = open_slots(path);
+	if (f == -1)
+		goto unlimited;
+
+	gettimeofday(&start, NULL);
+	deadline = time(NULL) + SLOT_TIMEOUT;
+
+	if (lock_counters(f, deadline) == -1 || counters(f, c, 0) == -1)
+		goto give_up;
+
+	ticket = c[0]++;
+	if (lock_byte(f, F_WRLCK, QUEUE_BYTE(ticket)) == -1 ||
+	    counters(f, c, 1) == -1) {
+		lock_byte(f, F_UNLCK, 0);
+		goto give_up;
+	}
+	queued = 1;
+	lock_byte(f, F_UNLCK, 0);
+
+	nap.tv_sec  = 0;
+	nap.tv_nsec = 10000000;
+
+	for (;;) {
+		if (lock_counters(f, deadline) == -1 || counters(f, c, 0) == -1)
+			goto give_up;
+
+		/* A filter whose turn it is takes a free slot if there is one;
+		 * a turn nobody is waiting for is skipped.
+		 */
+		if ((long) (ticket - c[1]) <= 0) {
+			for (i = 1; i <= config->max_gpg; i++) {
+				if (lock_byte(f, F_WRLCK, i) == 0)
+					goto got_slot;
+				if (!LOCK_BUSY(errno))
+					break;
+			}
+			if (i <= config->max_gpg) {
+				lock_byte(f, F_UNLCK, 0);
+				goto give_up;
+			}
+		} else if ((held = byte_locked(f, QUEUE_BYTE(c[1]))) == 0) {
+			c[1]++;
+			i = counters(f, c, 1);
+			lock_byte(f, F_UNLCK, 0);
+			if (i == -1)
+				goto give_up;
+			continue;
+		} else if (held == -1) {
+			lock_byte(f, F_UNLCK, 0);
+			goto give_up;
+		}
+
+		lock_byte(f, F_UNLCK, 0);
+
+		if (time(NULL) >= deadline) {
+			errno = ETIMEDOUT;
+			goto give_up;
+		}
+
+		waited = 1;
+		nanosleep(&nap, NULL);
+	}
+
+got_slot:
+	if ((long) (c[1] - ticket) <= 0) {
+		c[1] = ticket + 1;
+		counters(f, c, 1);
+	}
+	lock_byte(f, F_UNLCK, 0);
+	lock_byte(f, F_UNLCK, QUEUE_BYTE(ticket));
+
+	if (waited) {
+		gettimeofday(&end, NULL);
+		ms = (end.tv_sec - start.tv_sec) * 1000 +
+		     (end.tv_usec - start.tv_usec) / 1000;
+		note_x(config,
+		       "Waited %ld.%03ld seconds for a free GPG slot.",
+		       ms / 1000, ms % 1000);
+	}
+
+	*slot = f;
+
+	return 0;
+
+give_up:
+	/* Leaving the queue byte unlocked lets the others skip this turn. */
+	i = errno;
+	if (queued)
+		lock_byte(f, F_UNLCK, QUEUE_BYTE(ticket));
+	close(f);
+	errno = i;
+
+unlimited:
+	if (errno == ETIMEDOUT)
+		note_x(config, "No GPG slot came free in %d seconds; running "
+		       "GPG without the -j limit.", SLOT_TIMEOUT);
+	else
+		note_x(config, "Failed to use %s (%s); running GPG without "
+		       "the -j limit.", path, strerror(errno));
+
+	return 0;
+}
+
+/**
+ * Give back a GPG process slot taken with slot_acquire().
+ *
+ * @param  f  The descriptor returned by slot_acquire().
+ * @return    Nothing.
+ */
+void slot_release(int f)
+{
+	if (f != -1)
+		close(f);
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * slots.h - Host-wide GPG process slots.
+ */
+
+#include "pinegpg.h"
+
+#ifndef SLOTS_H
+#define SLOTS_H 1
+
+int  slot_acquire(const pinegpg_config *, int *);
+void slot_release(int);
+
+#endif /* SLOTS_H */
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * trace.c - Binary traces of GPG runs.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "pinegpg.h"
+#include "trace.h"
+
+/*
+ * A trace is a sequence of records, each a type byte, the payload length,
+ * and the payload.  Every number is an unsigned LEB128 varint and every
+ * string is a length followed by its bytes.  Each payload starts with the
+ * process ID of the filter, since several filters running at once may
+ * append to the same file.  Records are gathered in
+ * memory and appended with O_APPEND whole, so they never interleave.
+ *
+ *   C  call:   pid, version, seconds, microseconds, kind (transform,
+ *              protect, or import), pinegpg_how of a protect call (or 0),
+ *              input length, recipients, block limit, message limit
+ *   B  block:  pid, offset, length, type, offset of an earlier copy plus
+ *              one (or 0)
+ *   G  spawn:  pid, GPG pid, microseconds since the call, argc, argv...
+ *   I  I/O:    pid, GPG pid, stream (0-2), microseconds since the spawn,
+ *              bytes, content (stderr only, and empty when redacted);
+ *              stdin and stdout get one record each, stderr one per read;
+ *              the stdin record is made once the feeder has written it all
+ *   X  exit:   pid, GPG pid, wait status, elapsed, user, and system
+ *              microseconds, maximum resident set in kilobytes
+ *
+ * Nothing a message contains is ever recorded.  Redaction also drops what
+ * GPG says on stderr and every argument that is not an option, such as
+ * recipients and key names.
+ *
+ * Tracing is best effort: if the trace can not be written, it is dropped
+ * and the filter carries on.
+ */
+
+typedef struct _record {
+	size_t        len;
+	unsigned char buf[BUF_SIZE + 256];
+} record;
+
+static void put_num(record *r, unsigned long v)
+{
+	do {
+		if (r->len == sizeof (r->buf))
+			return;
+		r->buf[r->len++] = (v & 0x7f) | ((v > 0x7f) ? 0x80 : 0);
+		v >>= 7;
+	} while (v != 0);
+}
+
+static void put_str(record *r, const char *s, size_t len)
+{
+	if (len > sizeof (r->buf) - r->len - 8)
+		len = sizeof (r->buf) - r->len - 8;
+
+	put_num(r, len);
+	memcpy(r->buf + r->len, s, len);
+	r->len += len;
+}
+
+static unsigned long usecs(const struct timeval *from,
+			   const struct timeval *to)
+{
+	long us;
+
+	us = (to->tv_sec - from->tv_sec) * 1000000L +
+	     (to->tv_usec - from->tv_usec);
+
+	return (us < 0) ? 0 : us;
+}
+
+/**
+ * Write out the records gathered so far.
+ *
+ * @param  tr  The trace.
+ * @return     Nothing.
+ */
+static void flush(trace *tr)
+{
+	ssize_t bytes;
+
+	if (tr->len == 0)
+		return;
+
+	while ((bytes = write(tr->fd, tr->buf, tr->len)) == -1 &&
+	       errno == EINTR)
+		;
+
+	if (bytes != (ssize_t) tr->len) {
+		close(tr->fd);
+		free(tr->buf);
+		tr->fd = -1;
+	}
+
+	tr->len = 0;
+}
+
+/**
+ * Add a record to the trace.
+ *
+ * @param  tr    The trace.
+ * @param  type  The record type.
+ * @param  r     The payload.
+ * @return       Nothing.
+ */
+static void add(trace *tr, int type, const record *r)
+{
+	record head;
+
+	if (tr->len + r->len + 16 > 2 * BUF_SIZE)
+		flush(tr);
+
+	if (tr->fd == -1)
+		return;
+
+	head.len = 0;
+	head.buf[head.len++] = type;
+	put_num(&head, r->len);
+
+	memcpy(tr->buf + tr->len, head.buf, head.len);
+	tr->len += head.len;
+	memcpy(tr->buf + tr->len, r->buf, r->len);
+	tr->len += r->len;
+}
+
+/**
+ * Start tracing a library call, if the configuration asks for it.
+ *
+ * @param  tr      The trace.
+ * @param  config  The program configuration.
+ * @param  kind    TRACE_TRANSFORM, TRACE_PROTECT, or TRACE_IMPORT.
+ * @param  how     The pinegpg_how of a protect call, or zero.
+ * @param  len     The size of the input in bytes.
+ * @return         Nothing.
+ */
+void trace_open(trace *tr, const pinegpg_config *config, int kind,
+		int how, size_t len)
+{
+	record r;
+
+	tr->fd = -1;
+	tr->len = 0;
+
+	if (config->trace_file == NULL)
+		return;
+
+	tr->buf = malloc(2 * BUF_SIZE);
+	if (tr->buf == NULL)
+		return;
+
+	tr->fd = open(config->trace_file, O_WRONLY | O_CREAT | O_APPEND,
+		      S_IRUSR | S_IWUSR);
+	if (tr->fd == -1) {
+		free(tr->buf);
+		return;
+	}
+
+	tr->redact = config->trace_redact;
+	tr->pid = getpid();
+	gettimeofday(&tr->call, NULL);
+
+	r.len = 0;
+	put_num(&r, tr->pid);
+	put_num(&r, TRACE_VERSION);
+	put_num(&r, tr->call.tv_sec);
+	put_num(&r, tr->call.tv_usec);
+	put_num(&r, kind);
+	put_num(&r, how);
+	put_num(&r, len);
+	put_num(&r, config->nr_rcpts);
+	put_num(&r, config->max_block);
+	put_num(&r, config->max_message);
+	add(tr, TRACE_CALL, &r);
+}
+
+/**
+ * Trace a PGP block found by the scanner.
+ *
+ * @param  tr      The trace.
+ * @param  offset  The offset of the block in the input.
+ * @param  len     The size of the block in bytes.
+ * @param  type    The pinegpg_armor of the block.
+ * @param  copy    The offset of an earlier copy of it plus one, or 0.
+ * @return         Nothing.
+ */
+void trace_block(trace *tr, ptrdiff_t offset, size_t len, int type,
+		 ptrdiff_t copy)
+{
+	record r;
+
+	if (tr->fd == -1)
+		return;
+
+	r.len = 0;
+	put_num(&r, tr->pid);
+	put_num(&r, offset);
+	put_num(&r, len);
+	put_num(&r, type);
+	put_num(&r, copy);
+	add(tr, TRACE_BLOCK, &r);
+}
+
+/**
+ * Trace the start of a GPG process.
+ *
+ * @param  tr    The trace.
+ * @param  pid   The process ID of GPG.
+ * @param  args  Its argument list.
+ * @return       Nothing.
+ */
+void trace_spawn(trace *tr, long pid, char * const *args)
+{
+	int i, argc;
+	record r;
+
+	if (tr->fd == -1)
+		return;
+
+	gettimeofday(&tr->spawn, NULL);
+	tr->fed = 0;
+
+	for (argc = 0; args[argc] != NULL; argc++)
+		;
+
+	r.len = 0;
+	put_num(&r, tr->pid);
+	put_num(&r, pid);
+	put_num(&r, usecs(&tr->call, &tr->spawn));
+	put_num(&r, argc);
+
+	for (i = 0; i < argc; i++) {
+		if (tr->redact && i > 0 && args[i][0] != '-' &&
+		    args[i][0] != '\0')
+			put_str(&r, "*", 1);
+		else
+			put_str(&r, args[i], strlen(args[i]));
+	}
+
+	add(tr, TRACE_SPAWN, &r);
+}
+
+/**
+ * Trace data passed to or from GPG.
+ *
+ * @param  tr      The trace.
+ * @param  pid     The process ID of GPG.
+ * @param  stream  0 for its stdin, 1 for stdout, or 2 for stderr.
+ * @param  data    The data, kept only for stderr.
+ * @param  len     The size of the data in bytes.
+ * @return         Nothing.
+ */
+void trace_io(trace *tr, long pid, int stream, const char *data, size_t len)
+{
+	record r;
+	struct timeval now;
+
+	if (tr->fd == -1)
+		return;
+
+	gettimeofday(&now, NULL);
+
+	r.len = 0;
+	put_num(&r, tr->pid);
+	put_num(&r, pid);
+	put_num(&r, stream);
+	put_num(&r, usecs(&tr->spawn, &now));
+	put_num(&r, len);
+	put_str(&r, data, (stream == 2 && !tr->redact) ? len : 0);
+	add(tr, TRACE_IO, &r);
+}
+
+/**
+ * Trace GPG's stdin once its feeder has written all of it.  This is called
+ * as GPG's output is read, and looks at the feeder without reaping it; once
+ * the feeder has been reaped it is called with -1, and the record is made
+ * then if it was not before.
+ *
+ * @param  tr      The trace.
+ * @param  pid     The process ID of GPG.
+ * @param  feeder  The process ID of the feeder, or -1 once reaped.
+ * @param  len     The size of the data fed to GPG in bytes.
+ * @return         Nothing.
+ */
+void trace_fed(trace *tr, long pid, pid_t feeder, size_t len)
+{
+	siginfo_t info;
+
+	if (tr->fd == -1 || tr->fed)
+		return;
+
+	if (feeder != -1) {
+		info.si_pid = 0;
+		if (waitid(P_PID, feeder, &info,
+			   WEXITED | WNOHANG | WNOWAIT) == -1 ||
+		    info.si_pid == 0)
+			return;
+	}
+
+	tr->fed = 1;
+	trace_io(tr, pid, 0, NULL, len);
+}
+
+/**
+ * Trace the exit of a GPG process, just after it was reaped.
+ *
+ * @param  tr      The trace.
+ * @param  pid     The process ID of GPG.
+ * @param  status  Its wait status.
+ * @param  ru      The resources it used, from wait4(2).
+ * @return         Nothing.
+ */
+void trace_exit(trace *tr, long pid, int status, const struct rusage *ru)
+{
+	record r;
+	struct timeval now;
+	static const struct timeval zero = { 0, 0 };
+
+	if (tr->fd == -1)
+		return;
+
+	gettimeofday(&now, NULL);
+
+	r.len = 0;
+	put_num(&r, tr->pid);
+	put_num(&r, pid);
+	put_num(&r, (unsigned int) status);
+	put_num(&r, usecs(&tr->spawn, &now));
+	put_num(&r, usecs(&zero, &ru->ru_utime));
+	put_num(&r, usecs(&zero, &ru->ru_stime));
+	put_num(&r, ru->ru_maxrss);
+	add(tr, TRACE_EXIT, &r);
+}
+
+/**
+ * Finish tracing a library call.
+ *
+ * @param  tr  The trace.
+ * @return     Nothing.
+ */
+void trace_close(trace *tr)
+{
+	int e = errno;
+
+	if (tr->fd == -1)
+		return;
+
+	flush(tr);
+
+	if (tr->fd != -1) {
+		close(tr->fd);
+		free(tr->buf);
+		tr->fd = -1;
+	}
+
+	errno = e;
+}
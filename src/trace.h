@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * trace.h - Binary traces of GPG runs.
+ */
+
+#include "pinegpg.h"
+
+#ifndef TRACE_H
+#define TRACE_H 1
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stddef.h>
+
+#define TRACE_VERSION 2
+
+/* Record types. */
+#define TRACE_CALL	'C'
+#define TRACE_BLOCK	'B'
+#define TRACE_SPAWN	'G'
+#define TRACE_IO	'I'
+#define TRACE_EXIT	'X'
+
+/* What a call record describes. */
+#define TRACE_TRANSFORM	0
+#define TRACE_PROTECT	1
+#define TRACE_IMPORT	2
+
+typedef struct _trace {
+	int            fd;		/* -1 when not tracing */
+	int            redact;
+	long           pid;
+	struct timeval call;		/* start of the library call */
+	struct timeval spawn;		/* start of the current GPG */
+	int            fed;		/* its stdin has been traced */
+	size_t         len;
+	unsigned char  *buf;		/* records not yet written */
+} trace;
+
+void trace_open(trace *, const pinegpg_config *, int, int, size_t);
+void trace_block(trace *, ptrdiff_t, size_t, int, ptrdiff_t);
+void trace_spawn(trace *, long, char * const *);
+void trace_io(trace *, long, int, const char *, size_t);
+void trace_fed(trace *, long, pid_t, size_t);
+void trace_exit(trace *, long, int, const struct rusage *);
+void trace_close(trace *);
+
+#endif /* TRACE_H */
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * trustdb.c - Trust database maintenance.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <utime.h>
+
+#include "pinegpg.h"
+#include "proc.h"
+#include "utility.h"
+#include "trustdb.h"
+
+#include "config.h"
+
+/*
+ * The filters run every gpg(1) child with --no-auto-check-trustdb, so a
+ * large web of trust is never rebuilt in the middle of viewing a message.
+ * Instead pine.gpg -T runs the check from cron or after importing keys and
+ * touches a stamp file next to the keyring, and the display filter warns
+ * when that stamp grows older than TRUSTDB_MAX_AGE days.
+ */
+
+#define STAMP_NAME "pine.gpg-trustdb.stamp"
+
+/**
+ * Trust database maintenance mode: run gpg --check-trustdb and record
+ * when it last succeeded.  Never returns.
+ *
+ * @param  config  The program configuration.
+ */
+void trustdb(const program_config *config)
+{
+	char *args[6], *path, *p;
+	int i = 0, s, f;
+	pid_t pid;
+	const char *result_ok = "Trust database check completed successfully.";
+
+	p = strrchr(config->lib.gpg, '/');
+	args[i++] = (p == NULL) ? config->lib.gpg : p + 1;
+	args[i++] = "--batch";
+	if (config->lib.verbose > 0)
+		args[i++] = "--verbose";
+	if (config->lib.verbose > 1)
+		args[i++] = "--verbose";
+	args[i++] = "--check-trustdb";
+	args[i++] = NULL;
+
+	pid = fork();
+	if (pid == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to fork() GPG process");
+
+	if (pid == 0) {
+		if (limit_gpg(&config->lib) == -1)
+			_exit(127);
+		execv(config->lib.gpg, args);
+		die_x(127, errno, config->result_file, "Failed to execv(%s)",
+		      config->lib.gpg);
+	}
+
+	while (waitpid(pid, &s, 0) == -1) {
+		if (errno != EINTR)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to reap GPG process");
+	}
+
+	if (!WIFEXITED(s) || WEXITSTATUS(s) != 0)
+		die_x(EXIT_FAILURE, 0, config->result_file,
+		      "Trust database check failed");
+
+	path = gnupg_path(STAMP_NAME);
+	if (path == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to locate the GnuPG home directory");
+
+	f = open(path, O_WRONLY | O_CREAT, 0600);
+	if (f == -1 || close(f) == -1 || utime(path, NULL) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to update %s", path);
+
+	free(path);
+
+	die_x(EXIT_SUCCESS, 0, config->result_file, result_ok);
+}
+
+/**
+ * Write a one line warning to the display output if the trust database
+ * has not been checked within TRUSTDB_MAX_AGE days.  Nothing is written
+ * while the check is current, if -T has never been run, or if the age
+ * limit is configured as zero.
+ *
+ * @param  out  The output buffer of the display filter.
+ */
+void trustdb_warn(outbuf *out)
+{
+	char *path, line[160];
+	struct stat sbuf;
+	time_t now;
+	long days;
+	int len;
+
+	if (TRUSTDB_MAX_AGE <= 0)
+		return;
+
+	path = gnupg_path(STAMP_NAME);
+	if (path == NULL)
+		return;
+
+	/* Without a stamp nobody has asked for -T to be run, so there is
+	 * nothing to fall behind on.
+	 */
+	if (stat(path, &sbuf) == -1) {
+		free(path);
+		return;
+	}
+
+	free(path);
+
+	now = time(NULL);
+	days = (now - sbuf.st_mtime) / 86400;
+	if (days < TRUSTDB_MAX_AGE)
+		return;
+
+	len = snprintf(line, sizeof (line),
+		       "  [PINE.GPG] Warning: trust database last checked "
+		       "%ld days ago; run %s -T\n\n", days, PACKAGE);
+	out_write(out, line, len);
+}
@@ -18,12 +18,20 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
+
+#include "pinegpg.h"
+#include "probes.h"
+#include "proc.h"
+#include "utility.h"
 
 /**
  * Print an error message to the result file if available, or stderr if not,
@@ -69,10 +77,453 @@ void die_x(int status, int errnum, const char *result, const char *format, ...)
 
 	fprintf(stderr, "\n");
 
-	if (!use_result && status && status != 127) {
+	if (!use_result && status && status != 127 && isatty(0)) {
 		fprintf(stderr, "\n  [PINE.GPG] Press ENTER to exit.");
 		getchar();
 	}
 
+	PROBE2(die__exit, status, errnum);
+
 	exit(status);
 }
+
+/**
+ * Append an informational message from libpinegpg to the result file, if
+ * there is one.  This is the note function of the library configuration.
+ *
+ * @param  ctx  The path to the result file, or NULL.
+ * @param  msg  The message.
+ * @return      Nothing.
+ */
+void note_result(void *ctx, const char *msg)
+{
+	int f;
+	FILE *fp;
+
+	if (ctx == NULL)
+		return;
+
+	f = open(ctx, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	if (f == -1)
+		return;
+
+	fp = fdopen(f, "a");
+	if (fp == NULL) {
+		close(f);
+		return;
+	}
+
+	fprintf(fp, "[PINE.GPG] %s\n", msg);
+	fclose(fp);
+}
+
+/**
+ * Read the whole of an input file into memory.
+ *
+ * @param  f       The file descriptor of the input file.
+ * @param  size    The size of the input file in bytes.
+ * @param  result  The path to the result file.
+ * @return         A newly allocated buffer holding the file.
+ */
+char *read_input(const int f, const ssize_t size, const char *result)
+{
+	char *input;
+	ssize_t bytes, total;
+
+	input = malloc(sizeof (char) * size);
+	if (input == NULL)
+		die_x(EXIT_FAILURE, errno, result,
+		      "Failed to allocate buffer for input file");
+
+	total = 0;
+	while ((bytes = read(f, input + total, size - total)) != 0) {
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			else
+				die_x(EXIT_FAILURE, errno, result,
+				      "Input file read error");
+		}
+		total += bytes;
+	}
+
+	if (total != size)
+		die_x(EXIT_FAILURE, 0, result,
+		      "Bytes read (%d) does not match input file size (%d)",
+		      total, size);
+
+	return input;
+}
+
+/**
+ * Build the path of a file in the GnuPG home directory.
+ *
+ * @param  name  The file name.
+ * @return       A newly allocated path, or NULL if neither GNUPGHOME nor
+ *               HOME is set or memory ran out.
+ */
+char *gnupg_path(const char *name)
+{
+	char *dir, *path;
+	const char *sub = "";
+	size_t len;
+
+	dir = getenv("GNUPGHOME");
+	if (dir == NULL || *dir == '\0') {
+		dir = getenv("HOME");
+		if (dir == NULL || *dir == '\0')
+			return NULL;
+		sub = "/.gnupg";
+	}
+
+	len = strlen(dir) + strlen(sub) + strlen(name) + 2;
+	path = malloc(len);
+	if (path != NULL)
+		snprintf(path, len, "%s%s/%s", dir, sub, name);
+
+	return path;
+}
+
+/**
+ * Read a stream to its end into memory.
+ *
+ * @param  f       The file descriptor to read.
+ * @param  size    Set to the number of bytes read.
+ * @param  result  The path to the result file.
+ * @return         A newly allocated buffer holding the data.
+ */
+char *read_stream(const int f, ssize_t *size, const char *result)
+{
+	char *input;
+	ssize_t bytes, total = 0, input_size = OUT_BUF_SIZE;
+
+	input = malloc(sizeof (char) * input_size);
+	if (input == NULL)
+		die_x(EXIT_FAILURE, errno, result,
+		      "Failed to allocate buffer for input");
+
+	while ((bytes = read(f, input + total, input_size - total)) != 0) {
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			else
+				die_x(EXIT_FAILURE, errno, result,
+				      "Input read error");
+		}
+
+		total += bytes;
+		if (total == input_size) {
+			input_size *= 2;
+			input = realloc(input, sizeof (char) * input_size);
+			if (input == NULL)
+				die_x(EXIT_FAILURE, errno, result,
+				      "Failed to increase input buffer size");
+		}
+	}
+
+	*size = total;
+
+	return input;
+}
+
+/**
+ * Fork a feeder sub-process that writes a buffer to the write end of a pipe
+ * and exits.  The write end is closed in the parent.
+ *
+ * @param  data    The data to write.
+ * @param  len     The size of the data in bytes.
+ * @param  pin     The pipe to write to.
+ * @param  result  The path to the result file.
+ * @return         The process ID of the feeder.
+ */
+pid_t spawn_feeder(const char *data, const int len, int pin[2],
+		   const char *result)
+{
+	pid_t pid;
+
+	pid = start_feeder(data, len, pin);
+	if (pid == -1)
+		die_x(EXIT_FAILURE, errno, result,
+		      "Failed to create fork for feeder sub-process");
+
+	return pid;
+}
+
+/*
+ * Output to the input-turned-output file is gathered in a locked buffer of
+ * OUT_BUF_SIZE bytes and written out in as few calls as possible.  GPG output
+ * is read straight into the buffer with out_read() so that plaintext is only
+ * ever held in locked memory.
+ *
+ * A buffer set up with no descriptor instead holds everything in memory,
+ * growing as needed, until it is given a descriptor and flushed.
+ */
+
+/**
+ * Make sure an in-memory output buffer has room for more data.
+ *
+ * @param  ob    The output buffer.
+ * @param  need  The number of free bytes needed.
+ * @return       Nothing.
+ */
+static void out_grow(outbuf *ob, size_t need)
+{
+	size_t size = ob->size;
+
+	/* Exactly enough room is enough: the caller fills it in one go. */
+	while (size - ob->len < need) {
+		if (size > (size_t) -1 / 2)
+			die_x(EXIT_FAILURE, ENOMEM, ob->result_file,
+			      "Failed to increase output buffer size");
+		size *= 2;
+	}
+
+	if (size == ob->size)
+		return;
+
+	ob->buf = realloc(ob->buf, size);
+	if (ob->buf == NULL)
+		die_x(EXIT_FAILURE, errno, ob->result_file,
+		      "Failed to increase output buffer size");
+
+	ob->size = size;
+}
+
+/**
+ * Write a whole buffer to a file descriptor, retrying on short writes.
+ *
+ * @param  ob    The output buffer (for its descriptor and result file).
+ * @param  data  The data to write.
+ * @param  len   The size of the data in bytes.
+ * @return       Nothing.
+ */
+static void write_all(outbuf *ob, const char *data, size_t len)
+{
+	ssize_t bytes;
+
+	PROBE2(output__flush, ob->fd, len);
+
+	while (len > 0) {
+		bytes = write(ob->fd, data, len);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			else
+				die_x(EXIT_FAILURE, errno, ob->result_file,
+				      "Output file write error");
+		}
+		data += bytes;
+		len  -= bytes;
+	}
+}
+
+/**
+ * Set up an output buffer.
+ *
+ * @param  ob      The output buffer.
+ * @param  fd      The file descriptor to write to, or -1 to keep all
+ *                 output in (unlocked) memory.
+ * @param  result  The path to the result file.
+ * @return         Nothing.
+ */
+void out_init(outbuf *ob, int fd, const char *result)
+{
+	ob->fd = fd;
+	ob->len = 0;
+	ob->size = OUT_BUF_SIZE;
+	ob->result_file = result;
+
+	ob->buf = calloc(1, ob->size);
+	if (ob->buf == NULL)
+		die_x(EXIT_FAILURE, errno, result,
+		      "Failed to allocate output buffer");
+
+	if (fd != -1 && mlock(ob->buf, ob->size) == -1)
+		die_x(EXIT_FAILURE, errno, result,
+		      "Failed to lock output buffer memory");
+}
+
+/**
+ * Append data to an output buffer.  Data too large for a buffer with a
+ * descriptor is written out directly; an in-memory buffer grows to fit it.
+ *
+ * @param  ob    The output buffer.
+ * @param  data  The data to write.
+ * @param  len   The size of the data in bytes.
+ * @return       Nothing.
+ */
+void out_write(outbuf *ob, const char *data, size_t len)
+{
+	if (ob->fd == -1)
+		out_grow(ob, len);
+	else {
+		if (len > ob->size - ob->len)
+			out_flush(ob);
+
+		if (len >= ob->size) {
+			write_all(ob, data, len);
+			return;
+		}
+	}
+
+	memcpy(ob->buf + ob->len, data, len);
+	ob->len += len;
+}
+
+/**
+ * Read from a file descriptor straight into an output buffer.
+ *
+ * @param  ob   The output buffer.
+ * @param  fd   The file descriptor to read from.
+ * @param  max  The most bytes to read.
+ * @return      The number of bytes read, zero at end of file, or -1 with
+ *              errno set on error.
+ */
+ssize_t out_read(outbuf *ob, int fd, size_t max)
+{
+	ssize_t bytes;
+
+	if (ob->fd == -1)
+		out_grow(ob, BUF_SIZE);
+	else if (ob->len == ob->size)
+		out_flush(ob);
+
+	if (max > ob->size - ob->len)
+		max = ob->size - ob->len;
+
+	while ((bytes = read(fd, ob->buf + ob->len, max)) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	ob->len += bytes;
+
+	return bytes;
+}
+
+/**
+ * Find where the next byte written to an output buffer will land in its
+ * file.
+ *
+ * @param  ob  The output buffer.
+ * @return     The file offset, or -1 with errno set if the descriptor can
+ *             not seek.
+ */
+off_t out_tell(outbuf *ob)
+{
+	off_t off;
+
+	off = lseek(ob->fd, 0, SEEK_CUR);
+	if (off == -1)
+		return -1;
+
+	return off + ob->len;
+}
+
+/**
+ * Append a span of data already written to an output buffer's file, read
+ * back straight into the buffer so that it stays in locked memory.
+ *
+ * @param  ob   The output buffer.
+ * @param  off  The file offset of the span, as returned by out_tell().
+ * @param  len  The size of the span in bytes.
+ * @return      Nothing.
+ */
+void out_copy(outbuf *ob, off_t off, size_t len)
+{
+	ssize_t bytes;
+	size_t max;
+
+	out_flush(ob);
+
+	while (len > 0) {
+		if (ob->len == ob->size)
+			out_flush(ob);
+
+		max = ob->size - ob->len;
+		if (max > len)
+			max = len;
+
+		bytes = pread(ob->fd, ob->buf + ob->len, max, off);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			else
+				die_x(EXIT_FAILURE, errno, ob->result_file,
+				      "Output file read error");
+		}
+		if (bytes == 0)
+			die_x(EXIT_FAILURE, 0, ob->result_file,
+			      "Output file is shorter than expected");
+
+		ob->len += bytes;
+		off += bytes;
+		len -= bytes;
+	}
+}
+
+static int sink_write(void *ctx, const char *data, size_t len)
+{
+	out_write(ctx, data, len);
+	return 0;
+}
+
+static off_t sink_tell(void *ctx)
+{
+	return out_tell(ctx);
+}
+
+static int sink_copy(void *ctx, off_t off, size_t len)
+{
+	out_copy(ctx, off, len);
+	return 0;
+}
+
+static ssize_t sink_read(void *ctx, int fd, size_t max)
+{
+	return out_read(ctx, fd, max);
+}
+
+/**
+ * Set up a libpinegpg sink that appends to an output buffer.
+ *
+ * @param  ob        The output buffer.
+ * @param  sink      The sink.
+ * @param  seekable  Non-zero if earlier output can be read back from the
+ *                   buffer's descriptor (see out_copy()).
+ * @return           Nothing.
+ */
+void out_sink(outbuf *ob, pinegpg_sink *sink, int seekable)
+{
+	sink->write = sink_write;
+	sink->tell  = seekable ? sink_tell : NULL;
+	sink->copy  = seekable ? sink_copy : NULL;
+	sink->read  = sink_read;
+	sink->ctx   = ob;
+}
+
+/**
+ * Write out everything held in an output buffer.
+ *
+ * @param  ob  The output buffer.
+ * @return     Nothing.
+ */
+void out_flush(outbuf *ob)
+{
+	write_all(ob, ob->buf, ob->len);
+	ob->len = 0;
+}
+
+/**
+ * Flush and release an output buffer.
+ *
+ * @param  ob  The output buffer.
+ * @return     Nothing.
+ */
+void out_free(outbuf *ob)
+{
+	out_flush(ob);
+	munlock(ob->buf, ob->size);
+	free(ob->buf);
+	ob->buf = NULL;
+}
@@ -16,9 +16,35 @@
  * created 27 Jul 2004
  */
 
+#include "libpinegpg.h"
+#include "pinegpg.h"
+
 #ifndef UTILITY_H
 #define UTILITY_H 1
 
+#include <sys/types.h>
+
+typedef struct _outbuf {
+	int    fd;
+	char   *buf;
+	size_t len;
+	size_t size;
+	const char *result_file;
+} outbuf;
+
 void die_x(int, int, const char *, const char *, ...);
+void note_result(void *, const char *);
+char *read_input(const int, const ssize_t, const char *);
+char *read_stream(const int, ssize_t *, const char *);
+char *gnupg_path(const char *);
+pid_t spawn_feeder(const char *, const int, int [2], const char *);
+void out_init(outbuf *, int, const char *);
+void out_write(outbuf *, const char *, size_t);
+ssize_t out_read(outbuf *, int, size_t);
+off_t out_tell(outbuf *);
+void out_copy(outbuf *, off_t, size_t);
+void out_sink(outbuf *, pinegpg_sink *, int);
+void out_flush(outbuf *);
+void out_free(outbuf *);
 
 #endif /* UTILITY_H */
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * warm.c - Maildir warmer for the display filter.
+ * created 19 Oct 2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "cache.h"
+#include "pinegpg.h"
+#include "scan.h"
+#include "utility.h"
+#include "warm.h"
+
+#include "config.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#include <sys/inotify.h>
+
+/* How often the warmer prunes old cache entries, in seconds. */
+#define PRUNE_INTERVAL (60 * 60)
+
+/**
+ * Find the body of a message the display filter would be given as it is.
+ *
+ * @param  input  The message, headers and all.
+ * @param  len    The size of the message in bytes.
+ * @return        The start of the body, or NULL if there is none or (Al)pine
+ *                would decode it first (MIME multiparts and base64 or
+ *                quoted-printable bodies), which would never match.
+ */
+static const char *message_body(const char *input, size_t len)
+{
+	const char *p = input, *e = input + len, *nl, *v;
+
+	for (; p < e; p = nl + 1) {
+		nl = memchr(p, '\n', e - p);
+		if (nl == NULL)
+			return NULL;
+
+		if (p == nl || (*p == '\r' && p + 1 == nl))
+			return nl + 1;
+
+		if (nl - p > 13 && strncasecmp(p, "Content-Type:", 13) == 0) {
+			for (v = p + 13; v < nl && (*v == ' ' || *v == '\t');
+			     v++)
+				;
+			if (nl - v >= 10 && strncasecmp(v, "multipart/",
+							 10) == 0)
+				return NULL;
+		}
+
+		if (nl - p > 26 &&
+		    strncasecmp(p, "Content-Transfer-Encoding:", 26) == 0) {
+			for (v = p + 26; v < nl && (*v == ' ' || *v == '\t');
+			     v++)
+				;
+			if ((nl - v >= 6 && strncasecmp(v, "base64", 6) == 0)
+			    || (nl - v >= 16 &&
+				strncasecmp(v, "quoted-printable", 16) == 0))
+				return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Pre-render one delivered message, in a child process so that a failure
+ * can not stop the warmer.
+ *
+ * @param  config  The program configuration.
+ * @param  path    The message file.
+ * @return         Nothing.
+ */
+static void warm_file(const program_config *config, const char *path)
+{
+	int f, s;
+	const char *body, *e, *p;
+	char *input;
+	struct stat sbuf;
+	pinegpg_block first, blk;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to fork() warmer process");
+
+	if (pid != 0) {
+		while (waitpid(pid, &s, 0) == -1) {
+			if (errno != EINTR)
+				die_x(EXIT_FAILURE, errno, config->result_file,
+				      "Failed to reap warmer process");
+		}
+		return;
+	}
+
+	/* The user may have opened the message already. */
+	f = open(path, O_RDONLY);
+	if (f == -1 || fstat(f, &sbuf) == -1 || !S_ISREG(sbuf.st_mode) ||
+	    sbuf.st_size == 0)
+		_exit(EXIT_SUCCESS);
+
+	input = read_input(f, sbuf.st_size, config->result_file);
+	close(f);
+	e = input + sbuf.st_size;
+
+	body = message_body(input, sbuf.st_size);
+	if (body == NULL ||
+	    !find_block(input, body, e, PGP_FILTERED, &first))
+		_exit(EXIT_SUCCESS);
+
+	/* Decrypted text would be stored on disk, so encrypted messages are
+	 * only rendered when asked for.
+	 */
+	for (p = first.begin; !config->warm_encrypted &&
+	     find_block(input, p, e, PGP_FILTERED, &blk); p = blk.end) {
+		if (blk.type == PINEGPG_ARMOR_MESSAGE)
+			_exit(EXIT_SUCCESS);
+	}
+
+	if (cache_copy(config, first.begin, e - first.begin, NULL))
+		_exit(EXIT_SUCCESS);
+
+	if (cache_store(config, first.begin, e - first.begin) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to pre-render %s", path);
+
+	_exit(EXIT_SUCCESS);
+}
+
+/**
+ * Pre-render the messages already waiting in a new/ directory.
+ *
+ * @param  config  The program configuration.
+ * @param  dir     The new/ directory.
+ * @return         Nothing.
+ */
+static void warm_dir(const program_config *config, const char *dir)
+{
+	char path[PATH_MAX];
+	DIR *d;
+	struct dirent *de;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof (path), "%s/%s", dir, de->d_name);
+		warm_file(config, path);
+	}
+
+	closedir(d);
+}
+
+/**
+ * Maildir warmer mode: watch the new/ directories of the given Maildirs
+ * and pre-render each message delivered there for the display filter.
+ * Never returns.
+ *
+ * @param  config  The program configuration.
+ */
+void warm(const program_config *config)
+{
+	int i, fd, null, *wds;
+	char **dirs, path[PATH_MAX];
+	union {
+		struct inotify_event ev;
+		char buf[16 * (sizeof (struct inotify_event) + NAME_MAX + 1)];
+	} events;
+	const struct inotify_event *ev;
+	ssize_t bytes, off;
+	time_t pruned;
+
+	/* die_x() waits for ENTER when stdin is a terminal. */
+	null = open("/dev/null", O_RDONLY);
+	if (null == -1 || dup2(null, 0) == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to open /dev/null");
+	close(null);
+
+	fd = inotify_init();
+	if (fd == -1)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to start watching Maildirs");
+
+	wds = malloc(sizeof (int) * config->nr_maildirs);
+	dirs = malloc(sizeof (char *) * config->nr_maildirs);
+	if (wds == NULL || dirs == NULL)
+		die_x(EXIT_FAILURE, errno, config->result_file,
+		      "Failed to create array for Maildir list");
+
+	for (i = 0; i < config->nr_maildirs; i++) {
+		dirs[i] = malloc(strlen(config->maildirs[i]) +
+				 sizeof ("/new"));
+		if (dirs[i] == NULL)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to create array for Maildir list");
+		sprintf(dirs[i], "%s/new", config->maildirs[i]);
+
+		/* Deliveries are renamed in from tmp/, or rarely written in
+		 * place.
+		 */
+		wds[i] = inotify_add_watch(fd, dirs[i],
+					   IN_MOVED_TO | IN_CLOSE_WRITE);
+		if (wds[i] == -1)
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to watch %s", dirs[i]);
+	}
+
+	cache_prune();
+	pruned = time(NULL);
+
+	for (i = 0; i < config->nr_maildirs; i++)
+		warm_dir(config, dirs[i]);
+
+	for (;;) {
+		bytes = read(fd, events.buf, sizeof (events.buf));
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			die_x(EXIT_FAILURE, errno, config->result_file,
+			      "Failed to read Maildir events");
+		}
+
+		for (off = 0; off < bytes;
+		     off += sizeof (struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *) (events.buf + off);
+			if (ev->len == 0 || (ev->mask & IN_ISDIR) ||
+			    ev->name[0] == '.')
+				continue;
+
+			for (i = 0; i < config->nr_maildirs; i++) {
+				if (wds[i] == ev->wd)
+					break;
+			}
+			if (i == config->nr_maildirs)
+				continue;
+
+			snprintf(path, sizeof (path), "%s/%s", dirs[i],
+				 ev->name);
+			warm_file(config, path);
+		}
+
+		if (time(NULL) - pruned >= PRUNE_INTERVAL) {
+			cache_prune();
+			pruned = time(NULL);
+		}
+	}
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+void warm(const program_config *config)
+{
+	die_x(EXIT_FAILURE, 0, config->result_file,
+	      "Maildir warmer needs inotify, which this system lacks");
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
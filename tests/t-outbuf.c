@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+ *
+ * This file is part of PINE.GPG.
+ *
+ * PINE.GPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * PINE.GPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * LICENSE file distributed with PINE.GPG for more details.
+ *
+ * t-outbuf.c - In-memory output buffer regression test.
+ * created 19 Oct 2026
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#include "pinegpg.h"
+#include "utility.h"
+
+/**
+ * Write sizes around the buffer size into an in-memory output buffer, all
+ * of which must be kept rather than written to a descriptor.
+ *
+ * @return  Zero if every write was kept, or one if not.
+ */
+int main(void)
+{
+	static const size_t sizes[] = { OUT_BUF_SIZE, OUT_BUF_SIZE + 1,
+					OUT_BUF_SIZE - 1, 1 };
+	char *data;
+	size_t i, j, total = 0;
+	outbuf ob;
+
+	data = malloc(OUT_BUF_SIZE + 1);
+	if (data == NULL)
+		return 1;
+
+	out_init(&ob, -1, NULL);
+
+	for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		memset(data, 'a' + i, sizes[i]);
+		out_write(&ob, data, sizes[i]);
+		total += sizes[i];
+
+		if (ob.len != total || ob.size < ob.len) {
+			fprintf(stderr, "write of %lu: %lu bytes held\n",
+				(unsigned long) sizes[i],
+				(unsigned long) ob.len);
+			return 1;
+		}
+	}
+
+	for (i = 0, total = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		for (j = 0; j < sizes[i]; j++) {
+			if (ob.buf[total + j] != (char) ('a' + i)) {
+				fprintf(stderr, "write of %lu: bad byte %lu\n",
+					(unsigned long) sizes[i],
+					(unsigned long) j);
+				return 1;
+			}
+		}
+		total += sizes[i];
+	}
+
+	/* The sending filter gives the buffer a descriptor once GPG is done. */
+	ob.fd = open("/dev/null", O_WRONLY);
+	if (ob.fd == -1)
+		return 1;
+	out_free(&ob);
+	close(ob.fd);
+	free(data);
+
+	return 0;
+}
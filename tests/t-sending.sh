@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Copyright (C) 2004-2014  Calvin E. Peake, Jr. <cp@absolutedigital.net>
+#
+# This file is part of PINE.GPG.
+#
+# PINE.GPG is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# PINE.GPG is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# LICENSE file distributed with PINE.GPG for more details.
+#
+# t-sending.sh - Sending filter output larger than the output buffer.
+# created 19 Oct 2026
+
+# The sending filter holds GPG's output in memory until GPG succeeds.  A
+# stand-in GPG answers in one write of at least OUT_BUF_SIZE bytes, which
+# the filter reads as a single full chunk.
+
+pinegpg=../src/pine.gpg
+tmp=`mktemp -d` || exit 1
+trap 'rm -rf "$tmp"' 0
+
+GNUPGHOME=$tmp
+export GNUPGHOME
+
+for size in 32768 40000; do
+	head -c $size /dev/zero | tr '\0' A > "$tmp/out"
+
+	cat > "$tmp/gpg" <<-EOF
+	#!/bin/sh
+	cat > /dev/null
+	exec dd if="$tmp/out" bs=$size count=1 2> /dev/null
+	EOF
+	chmod +x "$tmp/gpg"
+
+	for mode in -S -E -B; do
+		echo "Test message." > "$tmp/msg"
+		rm -f "$tmp/result"
+
+		if ! $pinegpg $mode -g "$tmp/gpg" -r "$tmp/result" \
+		     -i "$tmp/msg" nobody@example.org < /dev/null ||
+		   ! cmp -s "$tmp/msg" "$tmp/out"; then
+			echo "$mode with $size bytes of output failed:"
+			cat "$tmp/result"
+			exit 1
+		fi
+	done
+done
+
+exit 0